@@ -24,8 +24,8 @@
 #ifndef LSVPDDEVICE_H_
 #define LSVPDDEVICE_H_
 
-#include <map>
 #include <string>
+#include <vector>
 #include <fstream>
 
 #include <subdevice.hpp>
@@ -52,16 +52,17 @@ namespace lsvpd
 		private:
 			int mID;
 			string mName;
-			map<int,SubDevice*> mSubDevs;
+			vector<SubDevice> mSubDevs;	/* Sorted by ID */
 
 		public:
 			Device( );
 			Device( ifstream& pciID );
-			~Device( );
 			const SubDevice* getSubDevice( int id ) const;
 
 			inline const string& getName( ) const { return mName; }
 			inline int getID( ) const { return mID; }
+			inline const vector<SubDevice>& getSubDevices( ) const
+				{ return mSubDevs; }
 
 			static const Device DEFAULT_DEV;
 
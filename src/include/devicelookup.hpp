@@ -24,16 +24,35 @@
 #ifndef LSVPDDEVICELOOKUP_H_
 #define LSVPDDEVICELOOKUP_H_
 
-#include <map>
 #include <string>
+#include <vector>
 #include <fstream>
 
+#include <sys/stat.h>
+
 #include <manufacturer.hpp>
 
 using namespace std;
 
+/* Where the binary form of the *.ids files is kept between runs */
+#define IDS_CACHE_DIR "/var/cache/lsvpd"
+
 namespace lsvpd
 {
+	struct IdsCacheHeader;
+	struct IdsCacheEntry;
+
+	/**
+	 * Where a manufacturer block starts in a lazily read *.ids file, and
+	 * the block once it has been parsed.
+	 */
+	struct IdsOffset {
+		int id;
+		streampos pos;
+		mutable Manufacturer *parsed;
+
+		inline int getID( ) const { return id; }
+	};
 
 	/**
 	 * DeviceLookup is the front end to the [pci|usb].ids files.  This file
@@ -43,6 +62,17 @@ namespace lsvpd
 	 * with the getManufacturer method, passing in the Manufacturer ID found
 	 * in sysfs.
 	 *
+	 * Parsing a whole *.ids file is slow, so the first DeviceLookup built
+	 * from a given file writes a binary copy of the tables (sorted ID
+	 * arrays and a string pool) to IDS_CACHE_DIR.  Later runs map that
+	 * copy, as long as the source file's mtime and size still match, and
+	 * answer getName queries straight from it.  getManufacturer is only
+	 * available when the text file was parsed.
+	 *
+	 * When no cache can be written, the text file is opened in lazy mode:
+	 * one pass records where each manufacturer block starts, and a block
+	 * is only parsed the first time one of its IDs is looked up.
+	 *
 	 * @class DeviceLookup
 	 * @ingroup lsvpd
 	 * @brief
@@ -54,14 +84,44 @@ namespace lsvpd
 	class DeviceLookup
 	{
 		private:
-			map<int,Manufacturer*> mManus;
+			vector<Manufacturer> mManus;	/* Sorted by ID */
 			static string idsPrefix;
 
+			/* Lazy mode: every manufacturer block, sorted by ID */
+			vector<IdsOffset> mManuOffsets;
+			mutable ifstream mIds;
+
+			/* Binary cache mapped in place of mManus, NULL if not used */
+			void *mMap;
+			size_t mMapLen;
+			const IdsCacheEntry *mCacheManus;
+			const IdsCacheEntry *mCacheDevs;
+			const IdsCacheEntry *mCacheSubs;
+			const char *mCachePool;
+
 			void fillManus( ifstream& idFile );
+			bool indexManus( const string& idsFile );
 			static void findIdsPrefix( );
 
+			static bool cacheWritable( );
+			static string cachePath( const string& idsFile );
+			bool mapCache( const string& idsFile,
+				const struct stat& src );
+			int writeCache( const string& idsFile,
+				const struct stat& src ) const;
+			const IdsCacheEntry* findCached( const IdsCacheEntry *first,
+				unsigned int count, int id ) const;
+
 		public:
-			DeviceLookup( ifstream& idFile );
+			/**
+			 * @param idsFile
+			 *   Location of the *.ids file, used to find and validate
+			 *   its binary cache
+			 * @param idFile
+			 *   The open *.ids file, only read when there is no valid
+			 *   cache
+			 */
+			DeviceLookup( const string& idsFile, ifstream& idFile );
 			~DeviceLookup( );
 			const Manufacturer* getManufacturer( int id ) const;
 
@@ -73,7 +133,7 @@ namespace lsvpd
 			 * @ret
 			 *   The Manufacturer name.
 			 */
-			const string& getName( int manID ) const;
+			string getName( int manID ) const;
 
 			/**
 			 * @brief
@@ -85,7 +145,7 @@ namespace lsvpd
 			 * @ret
 			 *   The Device name.
 			 */
-			const string& getName( int manID, int devID ) const;
+			string getName( int manID, int devID ) const;
 
 			/**
 			 * @brief
@@ -99,7 +159,7 @@ namespace lsvpd
 			 * @ret
 			 *   The Sub Device name.
 			 */
-			const string& getName( int manID, int devID, int subID )const;
+			string getName( int manID, int devID, int subID ) const;
 
 			static string getPciIds( );
 			static string getUsbIds( );
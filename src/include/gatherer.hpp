@@ -26,6 +26,7 @@
 #include <vector>
 
 #include <icollector.hpp>
+#include <inquirycache.hpp>
 #include <libvpd-2/component.hpp>
 #include <libvpd-2/system.hpp>
 
@@ -53,7 +54,7 @@ namespace lsvpd
 	class Gatherer
 	{
 		public:
-			Gatherer( bool limitSCSISize );
+			Gatherer( bool limitSCSISize, InquiryCacheMode cacheMode );
 			~Gatherer( );
 
 			/**
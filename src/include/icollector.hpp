@@ -138,6 +138,14 @@ namespace lsvpd
 				string getAttrValue( const string& path,
 					const string& attrName );
 
+				/**
+				 * Clean up a value read by getAttrValue: strip the
+				 * trailing newline and the blank padding of fixed width
+				 * fields, and replace anything that can't live on one
+				 * line with '_'.
+				 */
+				static string trimAttr( const string& val );
+
 				/**
 				 * Read a binary blob from given @path and store it in a string.
 				 * The string is returned by-value to the caller, and thus does
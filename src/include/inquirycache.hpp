@@ -0,0 +1,150 @@
+/***************************************************************************
+ *   Copyright (C) 2006, IBM                                               *
+ *                                                                         *
+ *   Maintained by:                                                        *
+ *   Eric Munson and Brad Peters                                           *
+ *   munsone@us.ibm.com, bpeters@us.ibm.com                                *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef LSVPDINQUIRYCACHE_H_
+#define LSVPDINQUIRYCACHE_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace lsvpd
+{
+	/* InquiryPage::cmd values for raw data that doesn't come from INQUIRY */
+	#define RAW_NVME_F1H_LOG	-1	/* NVMe log page 0xf1 */
+	#define RAW_NVME_MI_VPD		-2	/* NVMe-MI VPD read */
+	#define RAW_PCI_VPD		-3	/* sysfs PCI vpd file */
+	#define RAW_SCSI_SLOT		-4	/* Enclosure slot of a SCSI disk */
+
+	/**
+	 * How the cache built by an earlier run is used.
+	 */
+	enum InquiryCacheMode {
+		CACHE_IGNORE,	/* Query every device, rebuild the cache */
+		CACHE_REUSE,	/* Replay SCSI pages if the templates are unchanged */
+		CACHE_REPARSE	/* Replay everything stored, whatever the templates */
+	};
+
+	/**
+	 * One response recorded while querying a device, enough to replay
+	 * the query without touching the device.
+	 */
+	struct InquiryPage {
+		int cmd;	/* 0 for INQUIRY, the sg_utils command or RAW_* */
+		int evpd;
+		int pageCode;
+		int alloc;	/* Allocation length, 0 when sized by doSGQuery */
+		int ret;	/* Value the query returned */
+		string data;	/* Response bytes */
+	};
+
+	/**
+	 * InquiryCache keeps the SCSI inquiry responses of every device seen
+	 * by vpdupdate on disk, keyed by a stable device identity (WWN or
+	 * vendor, model and serial number).  A later run that finds the same
+	 * identity replays the recorded pages instead of issuing the commands
+	 * again.
+	 *
+	 * The whole cache is discarded when the stamp it was written with
+	 * (the state of the template file and the inquiry options) differs
+	 * from the current one, unless it is being reparsed.  Only entries
+	 * used during a run are written back, so devices that disappear age
+	 * out on the next update.
+	 *
+	 * Raw NVMe log pages and PCI VPD are kept as well, so that a reparse
+	 * run can rebuild the database from stored data alone.
+	 *
+	 * @class InquiryCache
+	 * @ingroup lsvpd
+	 */
+	class InquiryCache
+	{
+		private:
+			string mPath;
+			string mStamp;
+			InquiryCacheMode mMode;
+			map<string, vector<InquiryPage> > mOld;
+			map<string, vector<InquiryPage> > mCurrent;
+			bool mUsed;
+
+			void load( );
+
+		public:
+			/**
+			 * @param path
+			 *   Cache file location
+			 * @param stamp
+			 *   Identifies the template set and options that produced
+			 *   the cached pages
+			 * @param mode
+			 *   Whether and how previously cached pages are used
+			 */
+			InquiryCache( const string& path, const string& stamp,
+				InquiryCacheMode mode );
+			~InquiryCache( );
+
+			/**
+			 * True when stored data should be used in place of any
+			 * device access (vpdupdate --reparse).
+			 */
+			bool reparse( ) const { return mMode == CACHE_REPARSE; }
+
+			/**
+			 * Fetch the pages recorded for identity.
+			 * @return true if the identity was cached
+			 */
+			bool lookup( const string& identity,
+				vector<InquiryPage>& pages );
+
+			/**
+			 * Record the pages collected for identity in this run.
+			 */
+			void update( const string& identity,
+				const vector<InquiryPage>& pages );
+
+			/**
+			 * Write the entries used during this run back to disk.  A
+			 * run that never consulted the cache leaves it untouched.
+			 * @return 0 on success, -errno on failure
+			 */
+			int save( );
+
+			/**
+			 * Find the recorded response to one query in pages.
+			 * @return the page, or NULL if it wasn't recorded
+			 */
+			static const InquiryPage* findPage(
+				const vector<InquiryPage>& pages, int cmd, int evpd,
+				int pageCode, int alloc );
+
+			/**
+			 * Build a stamp from the modification time and size of a
+			 * file, so any edit to it invalidates the cache.
+			 */
+			static string fileStamp( const string& file );
+	};
+}
+
+#endif
@@ -24,8 +24,8 @@
 #ifndef LSVPDMANUFACTURER_H_
 #define LSVPDMANUFACTURER_H_
 
-#include <map>
 #include <string>
+#include <vector>
 #include <fstream>
 
 #include <device.hpp>
@@ -43,17 +43,18 @@ namespace lsvpd
 	{
 		private:
 			int mID;
-			map<int,Device*> mDevices;
+			vector<Device> mDevices;	/* Sorted by ID */
 			string mManuName;
 
 		public:
 			Manufacturer( );
 			Manufacturer( ifstream& pciID );
-			~Manufacturer( );
 			const Device* getDevice( int id ) const;
 
 			inline const string& getName( ) const { return mManuName; }
 			inline int getID( ) const { return mID; }
+			inline const vector<Device>& getDevices( ) const
+				{ return mDevices; }
 
 			static const Manufacturer DEFAULT_MANUFACTURER;
 	};
@@ -0,0 +1,39 @@
+/***************************************************************************
+ *   Copyright (C) 2006, IBM                                               *
+ *                                                                         *
+ *   Maintained by:                                                        *
+ *   Eric Munson and Brad Peters                                           *
+ *   munsone@us.ibm.com, bpeters@us.ibm.com                                *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef LSVPDSPYREVPD_H_
+#define LSVPDSPYREVPD_H_
+
+/*
+ * Device-specific keyword set on every Spyre card, telling whether its
+ * VPD was read from the card this run, copied from the previous database
+ * because the card was in use, or not found at all.  Stored in vpd.db
+ * with the card, and used by vpdupdate to find the cards it keeps in
+ * spyre.db.
+ */
+#define SPYRE_VPD_SOURCE	"XV"
+#define SPYRE_VPD_LIVE		"live"
+#define SPYRE_VPD_CACHED	"cached"
+#define SPYRE_VPD_NONE		"unavailable"
+
+#endif
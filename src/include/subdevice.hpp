@@ -24,7 +24,9 @@
 #ifndef LSVPDSUBDEVICE_H_
 #define LSVPDSUBDEVICE_H_
 
+#include <algorithm>
 #include <string>
+#include <vector>
 #include <fstream>
 #include <libvpd-2/logger.hpp>
 #include <libvpd-2/vpdexception.hpp>
@@ -36,6 +38,48 @@ namespace lsvpd
 
 	static const int UNKNOWN_ID = 0xffff;
 
+	/*
+	 * The [pci|usb].ids tables are kept as vectors sorted by ID.  These
+	 * helpers work on any entry type with a getID( ) method.
+	 */
+	template<class T> bool idLess( const T& a, const T& b )
+	{
+		return a.getID( ) < b.getID( );
+	}
+
+	template<class T> bool idEqual( const T& a, const T& b )
+	{
+		return a.getID( ) == b.getID( );
+	}
+
+	template<class T> bool idBelow( const T& a, int id )
+	{
+		return a.getID( ) < id;
+	}
+
+	/**
+	 * Sort entries by ID, keeping only the first one read for each ID.
+	 */
+	template<class T> void sortByID( vector<T>& entries )
+	{
+		stable_sort( entries.begin( ), entries.end( ), idLess<T> );
+		entries.erase( unique( entries.begin( ), entries.end( ),
+				       idEqual<T> ), entries.end( ) );
+	}
+
+	/**
+	 * @return the entry with id in sorted entries, or NULL
+	 */
+	template<class T> const T* findByID( const vector<T>& entries, int id )
+	{
+		typename vector<T>::const_iterator i;
+
+		i = lower_bound( entries.begin( ), entries.end( ), id, idBelow<T> );
+		if( i == entries.end( ) || i->getID( ) != id )
+			return NULL;
+		return &( *i );
+	}
+
 	/**
 	 * The SubDevice object will contain the SubDevice ID, the manufacturer id,
 	 * and the SubDevice name.
@@ -52,7 +96,6 @@ namespace lsvpd
 
 			SubDevice( );
 			SubDevice( ifstream& pciID );
-			~SubDevice( );
 
 			inline int getID( ) const { return mID; }
 			inline int getManuID( ) const { return mManuID; }
@@ -27,11 +27,18 @@
 #include <icollector.hpp>
 #include <fswalk.hpp>
 #include <devicelookup.hpp>
+#include <inquirycache.hpp>
+#include <vfiosession.hpp>
 
 #define SCSI_TEMPLATES_FILE "/etc/lsvpd/scsi_templates.conf"
 #define NVME_TEMPLATES_FILE "/etc/lsvpd/nvme_templates.conf"
+#define SCSI_INQUIRY_CACHE_FILE "/var/lib/lsvpd/scsi_inquiry.cache"
+#define PCI_OVERRIDES_FILE "/etc/lsvpd/pci_overrides.conf"
 
 #include <string>
+#include <set>
+#include <unordered_map>
+#include <stdint.h>
 
 namespace lsvpd
 {
@@ -49,6 +56,12 @@ namespace lsvpd
 	#define DEVICE_SCSI_SG_DEFAULT_EVPD_LEN 252
 	#define DEVICE_SCSI_SG_DEFAULT_STD_LEN 36
 	#define MAXBUFSIZE 4096
+	/*
+	 * Directory for device nodes made before udev has run.  It must be
+	 * on a file system that allows them: /run and /tmp are usually
+	 * mounted nodev, /dev is devtmpfs.
+	 */
+	#define DEVICE_NODE_TMPDIR "/dev"
 
 
 	/*
@@ -71,6 +84,98 @@ namespace lsvpd
 	#define NVME_MI_CMD_RECEIVE     0x1E
 	#define NVME_MI_VPD_DATA_LEN    256
 
+	/* Controllers queried at once when reading NVMe VPD ahead */
+	#define NVME_PREFETCH_THREADS	8
+
+	/**
+	 * VPD buffers read from one NVMe controller, kept for the rest of the
+	 * run.  The MI buffer is only read when log page 0xf1 isn't there.
+	 */
+	struct NvmeVpdData {
+		bool f1hRead;
+		int f1hRc;
+		string f1h;
+		bool miRead;
+		int miRc;
+		string mi;
+	};
+
+	/*
+	 * Disks of an enclosure whose diagnostic page 2 slot has to match
+	 * the SES slot before the rest of them take it from SES.
+	 */
+	#define SES_SLOT_CHECKS		2
+
+	/* Where the SES driver placed a device */
+	struct EnclosureSlot {
+		string enclosure;	/* sysfs path of the enclosure */
+		string slot;
+	};
+
+	/* Spyre cards whose EEPROM is read at once */
+	#define SPYRE_PREFETCH_THREADS	8
+
+	/**
+	 * Call work( i, arg ) for every i below count, from at most
+	 * maxThreads threads at once, and return when all calls are done.
+	 * Each call takes the next index, so one slow device doesn't hold
+	 * up the rest.  When no thread can be started the calls run in the
+	 * caller.
+	 * @return the number of threads that did the work
+	 */
+	unsigned int runBounded( unsigned int count, unsigned int maxThreads,
+		void (*work)( unsigned int i, void *arg ), void *arg );
+
+	/**
+	 * EEPROM words read from one Spyre card through BAR0, kept for the
+	 * rest of the run.  groupOpened is false when the card's IOMMU group
+	 * was busy, or not tried because of --reparse, and then nothing was
+	 * read.
+	 */
+	struct SpyreVpdData {
+		bool groupOpened;
+		bool read;
+		int rc;			/* 0, or -errno of the step that failed */
+		uint64_t eeprom;	/* Manufacturer and boot version word */
+		string eeprom11s;	/* 11S part and serial number */
+	};
+
+	/* Preference of pci_overrides.conf fields, above the adapter's VPD */
+	#define PCI_OVERRIDE_PREF	95
+
+	/**
+	 * One field pci_overrides.conf sets for an adapter.
+	 */
+	struct PciOverrideField {
+		string key;	/* PN, EC, FN, FC, CC, CE, or DS (description) */
+		string value;
+		int pref;
+	};
+
+	/* Bytes of PCI config space any user may read through sysfs */
+	#define PCI_CONFIG_HEADER_LEN	64
+
+	/* PCI VPD resource tags */
+	#define PCI_VPD_TAG_ID_STRING	0x82
+	#define PCI_VPD_TAG_RO		0x90
+	#define PCI_VPD_TAG_RW		0x91
+	#define PCI_VPD_TAG_END		0x78	/* Small resource, length bits clear */
+	#define PCI_VPD_MAX_LEN		0x8000
+
+	/**
+	 * Identity of a PCI function, decoded from the standard header of its
+	 * config space.  IDs that can't be read are UNKNOWN_ID.
+	 */
+	struct PciConfigIds {
+		int vendor;
+		int device;
+		int revision;	/* -1 if config space couldn't be read */
+		int classCode;	/* Base class, sub class and prog-if */
+		int headerType;	/* Without the multi-function bit */
+		int subVendor;
+		int subDevice;
+	};
+
 	/**
 	 * SysFSTreeCollector contains the logic for device discovery and VPD
 	 * retrieval from /sys and sg_utils.
@@ -86,7 +191,8 @@ namespace lsvpd
 	class SysFSTreeCollector : public ICollector
 	{
 		public:
-			SysFSTreeCollector( bool limitSCSISize );
+			SysFSTreeCollector( bool limitSCSISize,
+				InquiryCacheMode cacheMode );
 			~SysFSTreeCollector( );
 
 			bool init( );
@@ -125,9 +231,44 @@ namespace lsvpd
 			DeviceLookup* mPciTable;
 			DeviceLookup* mUsbTable;
 			bool mLimitSCSISize;
+			InquiryCache* mInquiryCache;
+			/* Pages read this run, per LUN identity, shared by all paths */
+			map<string, vector<InquiryPage> > mLunPages;
+			/* SCSI hosts driven by ipr, and where iprconfig lives */
+			set<string> mIprHosts;
+			string mIprconfigPath;
+			bool mIprScanned;
+			/* Enclosure slot of each SES-managed device, by sysfs path */
+			map<string, EnclosureSlot> mEnclosureSlots;
+			/*
+			 * Disks of each enclosure whose page 2 slot matched SES,
+			 * or -1 once one didn't
+			 */
+			map<string, int> mEnclosureChecks;
+			bool mEnclosuresScanned;
+			/* NVMe VPD read this run, see getNvmeControllerKey */
+			map<string, NvmeVpdData> mNvmeVpd;
+			bool mNvmePrefetched;
+			/* VFIO container shared by the Spyre cards, see fillSpyreVpd */
+			VfioSession mVfio;
+			/* Spyre EEPROM contents read this run, by sysfs path */
+			map<string, SpyreVpdData> mSpyreVpd;
+			bool mSpyrePrefetched;
+			/* PCI VPD read this run, by adapter, see fillPciDevVpd */
+			map<string, string> mPciVpd;
+			/* Adapter key of each PCI function whose VPD was read */
+			map<string, string> mPciVpdKeys;
+			/* Firmware version of each network PCI function, by path */
+			map<string, string> mNetFirmware;
+			/* pci_overrides.conf, by pciOverrideKey */
+			unordered_map<uint64_t, vector<PciOverrideField> > mPciOverrides;
+			/* Its entries for any subsystem, by vendor and device */
+			unordered_map<uint64_t, vector<PciOverrideField> > mPciOverridesAnySub;
+			bool mPciOverridesLoaded;
 
 			// nvme specific
 		        int load_nvme_templates(const string& filename);
+			bool haveNvmeTemplates( const string& ctrlDir );
 			int interpretNVMEf1hLogPage(Component *fillMe, char *data);
 			int interpretNVMEMiLog(Component *fillMe, char *data);
 
@@ -145,12 +286,30 @@ namespace lsvpd
 									char *data, int dataSize, string *format,
 									int pageCode);
 			void fillSpyreVpd(Component* fillMe);
-			string read11S(unsigned char* bar0_ptr);
+			void prefetchSpyreVpd( );
 			int collectNvmeVpd(Component *fillMe, int device_fd);
-
-			int collectVpd(Component *fillMe, int device_fd, bool limitSCSISize);
+			int readNvmeVpd(const string& identity, const string& ctrlDir,
+				int device_fd, int kind, char *buf, int len);
+			void prefetchNvmeVpd( );
+			string getNvmeControllerKey( const string& ctrlDir );
+			string getNvmeIdentity( const string& ctrlDir );
+
+			bool storedRawData( const string& identity, int kind,
+				string& data, int& ret );
+			void storeRawData( const string& identity, int kind,
+				const string& data, int ret );
+
+			int collectVpd(Component *fillMe, int& device_fd, bool limitSCSISize,
+				vector<InquiryPage> *pages = NULL, bool replay = false,
+				bool mayOpen = false);
 			void fillSCSIComponent( Component* fillMe, bool limitSCSISize);
+			string getScsiIdentity( Component *fillMe );
 			string findGenericSCSIDevPath( Component *fillMe );
+			void findIPRHosts( );
+			void findEnclosureSlots( );
+			string getEnclosureSlot( Component *fillMe );
+			void checkEnclosureSlot( Component *fillMe,
+				const string& diagSlot );
 			void fillIPRData( Component *fillMe );
 			void parseIPRData( Component *fillMe, string& output );
 			int get_mm_scsi(Component *fillMe);
@@ -211,8 +370,22 @@ namespace lsvpd
 			 */
 			void fillPCIDev( Component* fillMe, const string& sysDir );
 
+			/**
+			 * Decode the IDs of the PCI function at sysDir from one
+			 * read of its config space, falling back on the sysfs
+			 * attributes for values the header doesn't hold.
+			 */
+			void readPciConfigIds( const string& sysDir,
+				PciConfigIds& ids );
+
+			/**
+			 * Load the adapter fields of pci_overrides.conf.
+			 * @return 0 on success, -ENOENT if the file is missing
+			 */
+			int loadPciOverrides( const string& filename );
+
 			/** Set custom VPD fields for specific devices based on
-			 * device/vendor IDs.
+			 * device/vendor IDs, as listed in pci_overrides.conf.
 			 * @param fillMe: Component to populate with custom VPD data
 			 * @param vendorId: PCI vendor ID
 			 * @param deviceId: PCI device ID
@@ -291,15 +464,24 @@ namespace lsvpd
 			 *
 			 * @param fillMe
 			 *   The Component to fill
+			 * @param node
+			 *   The /sys dir of the function whose VPD is used, the
+			 *   physical function for an SR-IOV VF
+			 * @param ids
+			 *   The config space IDs of node, NULL to read them only
+			 *   if node hasn't been seen yet
 			 */
-			void fillPciDevVpd( Component* fillMe );
+			void fillPciDevVpd( Component* fillMe, const string& node,
+				const PciConfigIds* ids );
 
 			/**
-			 * Parse device info in two parts : key & data.
+			 * Parse the keywords of the VPD-R and VPD-W resources in
+			 * a PCI VPD image.
 			 *
 			 * @param fillMe
-			 * @param buf: vpd key and data list
+			 * @param buf: vpd resources, as read by readPciVpd
 			 * @param size : buffer size
+			 * @return bytes parsed, up to the end tag, 0 if corrupt
 			 */
 			unsigned int parsePciVPDBuffer( Component* fillMe,
 						        const char * buf , int size );
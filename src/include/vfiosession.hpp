@@ -0,0 +1,85 @@
+/***************************************************************************
+ *   Copyright (C) 2006, IBM                                               *
+ *                                                                         *
+ *   Maintained by:                                                        *
+ *   Eric Munson and Brad Peters                                           *
+ *   munsone@us.ibm.com, bpeters@us.ibm.com                                *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#ifndef LSVPDVFIOSESSION_H_
+#define LSVPDVFIOSESSION_H_
+
+#include <map>
+#include <string>
+
+using namespace std;
+
+namespace lsvpd
+{
+	/**
+	 * VfioSession owns one VFIO container for a vpdupdate run.  The
+	 * container is opened and its IOMMU type probed the first time a
+	 * device is asked for.  Every IOMMU group is attached to it once and
+	 * stays attached until the session ends, so the IOMMU is only set up
+	 * for the first group and each later device costs no more than its
+	 * own device fd.
+	 *
+	 * Not every IOMMU lets groups share a container: on sPAPR a second
+	 * group is refused unless the platform can hand its DMA window
+	 * over.  A group the shared container won't take gets a container
+	 * of its own, as every group had before the session existed.
+	 *
+	 * @class VfioSession
+	 * @ingroup lsvpd
+	 */
+	class VfioSession
+	{
+		private:
+			int mContainer;		/* -1 until opened */
+			bool mBroken;		/* No usable container this run */
+			int mIommuType;		/* -1 until probed */
+			bool mIommuSet;
+			map<string, int> mGroups;	/* Attached group fds by name */
+			/* Containers of groups the shared one refused, by name */
+			map<string, int> mPrivate;
+
+			int openContainer( );
+			int setContainer( const string& group, int groupFd,
+				int container, bool& iommuSet );
+			int attachGroup( const string& group, int groupFd );
+
+		public:
+			VfioSession( );
+			~VfioSession( );
+
+			/**
+			 * Get a VFIO device fd for the PCI function at sysDir,
+			 * attaching its IOMMU group to the container if that
+			 * hasn't been done yet.  The caller closes the fd.
+			 *
+			 * @param groupOpened
+			 *   Set to false if the group node itself couldn't be
+			 *   opened, because it is in use or not accessible
+			 * @return the device fd, or -errno
+			 */
+			int getDeviceFd( const string& sysDir, bool& groupOpened );
+	};
+}
+
+#endif
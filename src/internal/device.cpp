@@ -74,20 +74,7 @@ namespace lsvpd
 				else
 				{
 					pciID.get( next );
-					SubDevice* s = new SubDevice( pciID );
-					if( s == NULL )
-					{
-						Logger logger;
-						logger.log( "Out of memory.", LOG_ERR );
-						VpdException ve( "Out of memory." );
-						throw ve;
-					}
-
-					if(
-						!mSubDevs.insert( make_pair( s->getID( ), s ) ).second )
-					{
-						delete s;
-					}
+					mSubDevs.push_back( SubDevice( pciID ) );
 				}
 			}
 			else if( next == '#' )
@@ -100,16 +87,8 @@ namespace lsvpd
 				done = true;
 			}
 		}
-	}
 
-	Device::~Device( )
-	{
-		map<int,SubDevice*>::iterator i, end;
-		for( i = mSubDevs.begin( ), end = mSubDevs.end( ); i != end; ++i )
-		{
-			SubDevice* s = (*i).second;
-			delete s;
-		}
+		sortByID( mSubDevs );
 	}
 
 	const SubDevice* Device::getSubDevice( int id ) const
@@ -119,10 +98,10 @@ namespace lsvpd
 			return  &SubDevice::DEFAULT_SUB_DEV;
 		}
 
-		map<int,SubDevice*>::const_iterator i = mSubDevs.find( id );
-		if( mSubDevs.end( ) != i )
+		const SubDevice* s = findByID( mSubDevs, id );
+		if( s != NULL )
 		{
-			return (*i).second;
+			return s;
 		}
 		return &SubDevice::DEFAULT_SUB_DEV;
 	}
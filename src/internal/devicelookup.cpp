@@ -27,7 +27,27 @@
 #include <libvpd-2/vpdexception.hpp>
 #include <libvpd-2/lsvpd.hpp>
 
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+/*
+ * Binary cache layout: an IdsCacheHeader, then the manufacturer, device
+ * and sub device IdsCacheEntry arrays, then the string pool.  Each array
+ * is sorted by ID within the range owned by its parent, so every lookup
+ * is a binary search.  The cache is private to this host and is written
+ * in native byte order.
+ */
+#define IDS_CACHE_MAGIC		"LSVPDIDS"
+#define IDS_CACHE_VERSION	1
 
 /**
  * The Manufacturer object will store the id and name of a single manufacturer
@@ -36,19 +56,60 @@
  */
 namespace lsvpd
 {
+	struct IdsCacheHeader {
+		char magic[ 8 ];
+		uint32_t version;
+		uint32_t manus;		/* Number of manufacturer entries */
+		uint32_t devs;		/* Number of device entries */
+		uint32_t subs;		/* Number of sub device entries */
+		uint32_t poolLen;	/* Bytes in the string pool */
+		uint32_t pad;
+		/* The *.ids file the tables were built from */
+		int64_t srcMtime;
+		int64_t srcMtimeNsec;
+		int64_t srcSize;
+		int64_t srcIno;
+	};
 
-	DeviceLookup::DeviceLookup( ifstream& pciID )
+	struct IdsCacheEntry {
+		uint32_t id;
+		uint32_t name;		/* Offset of the name in the string pool */
+		uint32_t first;		/* First child in the next array */
+		uint32_t count;		/* Number of children */
+	};
+
+	DeviceLookup::DeviceLookup( const string& idsFile, ifstream& pciID ) :
+		mMap( NULL ), mMapLen( 0 ), mCacheManus( NULL ),
+		mCacheDevs( NULL ), mCacheSubs( NULL ), mCachePool( NULL )
 	{
+		struct stat src;
+		bool haveStat = stat( idsFile.c_str( ), &src ) == 0;
+
+		if( haveStat && mapCache( idsFile, src ) )
+			return;
+
+		/*
+		 * Building the cache needs every entry.  If it can't be saved,
+		 * only parse what this run asks for.
+		 */
+		if( ( !haveStat || !cacheWritable( ) ) && indexManus( idsFile ) )
+			return;
+
 		fillManus( pciID );
+
+		if( haveStat )
+			writeCache( idsFile, src );
 	}
 
 	DeviceLookup::~DeviceLookup( )
 	{
-		map<int,Manufacturer*>::iterator i, end;
-		for( i = mManus.begin( ), end = mManus.end( ); i != end; ++i )
+		if( mMap != NULL )
+			munmap( mMap, mMapLen );
+
+		vector<IdsOffset>::iterator i;
+		for( i = mManuOffsets.begin( ); i != mManuOffsets.end( ); ++i )
 		{
-			Manufacturer* m = (*i).second;
-			delete m;
+			delete i->parsed;
 		}
 	}
 
@@ -65,21 +126,46 @@ namespace lsvpd
 			}
 			else
 			{
-				Manufacturer* m = new Manufacturer( pciID );
-				if( m == NULL )
-				{
-					Logger logger;
-					logger.log( "Out of memory.", LOG_ERR );
-					VpdException ve( "Out of memory." );
-					throw ve;
-				}
+				mManus.push_back( Manufacturer( pciID ) );
+			}
+		}
 
-				if( !mManus.insert( make_pair( m->getID( ), m ) ).second )
-				{
-					delete m;
-				}
+		sortByID( mManus );
+	}
+
+	/**
+	 * Record the offset of each manufacturer line in idsFile, following
+	 * the same rules as fillManus, without parsing the blocks.
+	 * @return false if the file can't be read
+	 */
+	bool DeviceLookup::indexManus( const string& idsFile )
+	{
+		string line;
+		streampos pos;
+
+		mIds.open( idsFile.c_str( ), ios::in );
+		if( !mIds )
+			return false;
+
+		pos = mIds.tellg( );
+		while( getline( mIds, line ) )
+		{
+			if( !line.empty( ) && line[ 0 ] != '#' && line[ 0 ] != '\t' )
+			{
+				IdsOffset o;
+
+				o.id = strtol( line.c_str( ), NULL, 16 );
+				o.pos = pos;
+				o.parsed = NULL;
+				mManuOffsets.push_back( o );
 			}
+			pos = mIds.tellg( );
 		}
+		mIds.clear( );
+
+		/* The first block with an ID wins, as in fillManus */
+		sortByID( mManuOffsets );
+		return true;
 	}
 
 	const Manufacturer* DeviceLookup::getManufacturer( int id ) const
@@ -89,37 +175,319 @@ namespace lsvpd
 			return &Manufacturer::DEFAULT_MANUFACTURER;
 		}
 
-		map<int,Manufacturer*>::const_iterator i = mManus.find( id );
-		if( i == mManus.end( ) )
+		const IdsOffset* off = findByID( mManuOffsets, id );
+		if( off != NULL )
+		{
+			if( off->parsed == NULL )
+			{
+				mIds.clear( );
+				mIds.seekg( off->pos );
+				off->parsed = new Manufacturer( mIds );
+			}
+			return off->parsed;
+		}
+
+		const Manufacturer* m = findByID( mManus, id );
+		if( m == NULL )
 		{
 			// Requested Manufacturer was not in the table.
 			// Return the default Manucaturer Object.
 			return &Manufacturer::DEFAULT_MANUFACTURER;
 		}
-		else
-		{
-			return (*i).second;
-		}
+		return m;
 	}
 
-	const string& DeviceLookup::getName( int manID ) const
+	string DeviceLookup::getName( int manID ) const
 	{
+		if( mMap != NULL )
+		{
+			const IdsCacheHeader *h = (const IdsCacheHeader*)mMap;
+			const IdsCacheEntry *m;
+
+			m = findCached( mCacheManus, h->manus, manID );
+			if( m == NULL )
+				return Manufacturer::DEFAULT_MANUFACTURER.getName( );
+			return mCachePool + m->name;
+		}
+
 		return (getManufacturer( manID ))->getName( );
 	}
 
-	const string& DeviceLookup::getName( int manID, int devID ) const
+	string DeviceLookup::getName( int manID, int devID ) const
 	{
+		if( mMap != NULL )
+		{
+			const IdsCacheHeader *h = (const IdsCacheHeader*)mMap;
+			const IdsCacheEntry *m, *d = NULL;
+
+			m = findCached( mCacheManus, h->manus, manID );
+			if( m != NULL )
+				d = findCached( mCacheDevs + m->first, m->count,
+						devID );
+			if( d == NULL )
+				return Device::DEFAULT_DEV.getName( );
+			return mCachePool + d->name;
+		}
+
 		const Manufacturer *m = getManufacturer( manID );
 		return (m->getDevice( devID ))->getName( );
 	}
 
-	const string& DeviceLookup::getName( int manID, int devID, int subID ) const
+	string DeviceLookup::getName( int manID, int devID, int subID ) const
 	{
+		if( mMap != NULL )
+		{
+			const IdsCacheHeader *h = (const IdsCacheHeader*)mMap;
+			const IdsCacheEntry *m, *d = NULL, *sub = NULL;
+
+			m = findCached( mCacheManus, h->manus, manID );
+			if( m != NULL )
+				d = findCached( mCacheDevs + m->first, m->count,
+						devID );
+			if( d != NULL )
+				sub = findCached( mCacheSubs + d->first, d->count,
+						  subID );
+			if( sub == NULL )
+				return SubDevice::DEFAULT_SUB_DEV.getName( );
+			return mCachePool + sub->name;
+		}
+
 		const Manufacturer* m = getManufacturer( manID );
 		const Device* d = m->getDevice( devID );
 		return (d->getSubDevice( subID ))->getName( );
 	}
 
+	/**
+	 * Binary search count entries starting at first for id.
+	 * @return the entry, or NULL if id is UNKNOWN_ID or not there
+	 */
+	const IdsCacheEntry* DeviceLookup::findCached(
+		const IdsCacheEntry *first, unsigned int count, int id ) const
+	{
+		unsigned int lo = 0, hi = count;
+
+		if( id == UNKNOWN_ID )
+			return NULL;
+
+		while( lo < hi )
+		{
+			unsigned int mid = lo + ( hi - lo ) / 2;
+
+			if( first[ mid ].id == (uint32_t)id )
+				return &first[ mid ];
+			if( first[ mid ].id < (uint32_t)id )
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return NULL;
+	}
+
+	/**
+	 * @return true if a cache file can be created in IDS_CACHE_DIR
+	 */
+	bool DeviceLookup::cacheWritable( )
+	{
+		if( mkdir( IDS_CACHE_DIR, 0755 ) != 0 && errno != EEXIST )
+			return false;
+		return access( IDS_CACHE_DIR, W_OK ) == 0;
+	}
+
+	string DeviceLookup::cachePath( const string& idsFile )
+	{
+		string::size_type slash = idsFile.rfind( '/' );
+		string base = idsFile;
+
+		if( slash != string::npos )
+			base = idsFile.substr( slash + 1 );
+		return string( IDS_CACHE_DIR ) + "/" + base + ".cache";
+	}
+
+	/**
+	 * Map the binary cache of idsFile if it was built from the file
+	 * described by src and passes a sanity check.
+	 * @return true if the cache is in use
+	 */
+	bool DeviceLookup::mapCache( const string& idsFile,
+				     const struct stat& src )
+	{
+		string path = cachePath( idsFile );
+		const IdsCacheHeader *h;
+		const IdsCacheEntry *e;
+		struct stat info;
+		uint64_t expect;
+		void *map;
+		uint32_t i;
+		int fd;
+
+		fd = open( path.c_str( ), O_RDONLY );
+		if( fd < 0 )
+			return false;
+
+		if( fstat( fd, &info ) != 0 ||
+		    (size_t)info.st_size < sizeof( IdsCacheHeader ) )
+		{
+			close( fd );
+			return false;
+		}
+
+		map = mmap( NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+		close( fd );
+		if( map == MAP_FAILED )
+			return false;
+
+		h = (const IdsCacheHeader*)map;
+		expect = sizeof( IdsCacheHeader ) + (uint64_t)sizeof( IdsCacheEntry ) *
+			( (uint64_t)h->manus + h->devs + h->subs ) + h->poolLen;
+
+		if( memcmp( h->magic, IDS_CACHE_MAGIC, sizeof( h->magic ) ) != 0 ||
+		    h->version != IDS_CACHE_VERSION ||
+		    h->srcMtime != (int64_t)src.st_mtime ||
+		    h->srcMtimeNsec != (int64_t)src.st_mtim.tv_nsec ||
+		    h->srcSize != (int64_t)src.st_size ||
+		    h->srcIno != (int64_t)src.st_ino ||
+		    expect != (uint64_t)info.st_size || h->poolLen == 0 )
+			goto stale;
+
+		mCacheManus = (const IdsCacheEntry*)( h + 1 );
+		mCacheDevs = mCacheManus + h->manus;
+		mCacheSubs = mCacheDevs + h->devs;
+		mCachePool = (const char*)( mCacheSubs + h->subs );
+
+		if( mCachePool[ h->poolLen - 1 ] != '\0' )
+			goto stale;
+
+		/* Never follow an offset out of the mapping */
+		for( i = 0, e = mCacheManus; i < h->manus + h->devs + h->subs;
+		     i++, e++ )
+		{
+			uint64_t end = (uint64_t)e->first + e->count;
+
+			if( e->name >= h->poolLen ||
+			    ( i < h->manus && end > h->devs ) ||
+			    ( i >= h->manus && end > h->subs ) )
+				goto stale;
+		}
+
+		mMap = map;
+		mMapLen = info.st_size;
+		return true;
+
+	stale:
+		munmap( map, info.st_size );
+		mCacheManus = mCacheDevs = mCacheSubs = NULL;
+		mCachePool = NULL;
+		return false;
+	}
+
+	/**
+	 * Write the parsed tables out as the binary cache of idsFile,
+	 * stamped with the identity of the source file.
+	 * @return 0 on success, -errno on failure
+	 */
+	int DeviceLookup::writeCache( const string& idsFile,
+				      const struct stat& src ) const
+	{
+		string path = cachePath( idsFile ), tmpPath = path + ".tmp";
+		vector<IdsCacheEntry> manus, devs, subs;
+		vector<Manufacturer>::const_iterator m;
+		vector<Device>::const_iterator d;
+		vector<SubDevice>::const_iterator sub;
+		IdsCacheHeader h;
+		IdsCacheEntry e;
+		string pool;
+		ofstream out;
+
+		for( m = mManus.begin( ); m != mManus.end( ); ++m )
+		{
+			const vector<Device>& mDevs = m->getDevices( );
+
+			e.id = m->getID( );
+			e.name = pool.length( );
+			e.first = devs.size( );
+			e.count = mDevs.size( );
+			pool += m->getName( );
+			pool += '\0';
+			manus.push_back( e );
+
+			for( d = mDevs.begin( ); d != mDevs.end( ); ++d )
+			{
+				const vector<SubDevice>& dSubs = d->getSubDevices( );
+
+				e.id = d->getID( );
+				e.name = pool.length( );
+				e.first = subs.size( );
+				e.count = dSubs.size( );
+				pool += d->getName( );
+				pool += '\0';
+				devs.push_back( e );
+
+				for( sub = dSubs.begin( ); sub != dSubs.end( ); ++sub )
+				{
+					e.id = sub->getID( );
+					e.name = pool.length( );
+					e.first = e.count = 0;
+					pool += sub->getName( );
+					pool += '\0';
+					subs.push_back( e );
+				}
+			}
+		}
+
+		if( pool.empty( ) )
+			pool += '\0';
+
+		memset( &h, 0, sizeof( h ) );
+		memcpy( h.magic, IDS_CACHE_MAGIC, sizeof( h.magic ) );
+		h.version = IDS_CACHE_VERSION;
+		h.manus = manus.size( );
+		h.devs = devs.size( );
+		h.subs = subs.size( );
+		h.poolLen = pool.length( );
+		h.srcMtime = src.st_mtime;
+		h.srcMtimeNsec = src.st_mtim.tv_nsec;
+		h.srcSize = src.st_size;
+		h.srcIno = src.st_ino;
+
+		out.open( tmpPath.c_str( ), ios::out | ios::trunc | ios::binary );
+		if( !out )
+		{
+			int err = errno;
+			Logger logger;
+			logger.log( "Unable to write ids cache " + tmpPath,
+				    LOG_WARNING );
+			return -err;
+		}
+
+		out.write( (const char*)&h, sizeof( h ) );
+		if( !manus.empty( ) )
+			out.write( (const char*)&manus[ 0 ],
+				   manus.size( ) * sizeof( IdsCacheEntry ) );
+		if( !devs.empty( ) )
+			out.write( (const char*)&devs[ 0 ],
+				   devs.size( ) * sizeof( IdsCacheEntry ) );
+		if( !subs.empty( ) )
+			out.write( (const char*)&subs[ 0 ],
+				   subs.size( ) * sizeof( IdsCacheEntry ) );
+		out.write( pool.data( ), pool.length( ) );
+
+		out.close( );
+		if( !out )
+		{
+			unlink( tmpPath.c_str( ) );
+			return -EIO;
+		}
+
+		if( rename( tmpPath.c_str( ), path.c_str( ) ) != 0 )
+		{
+			int err = errno;
+			unlink( tmpPath.c_str( ) );
+			return -err;
+		}
+
+		return 0;
+	}
+
 	void DeviceLookup::findIdsPrefix( )
 	{
 		/*
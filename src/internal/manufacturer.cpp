@@ -71,25 +71,10 @@ namespace lsvpd
 			else if( next == '\t' )
 			{
 				pciID.get( next );
-				Device* d = new Device( pciID );
-				if( d == NULL )
+				mDevices.push_back( Device( pciID ) );
+				if( mDevices.back( ).getID( ) == UNKNOWN_ID )
 				{
-					Logger logger;
-					logger.log( "Out of memory.", LOG_ERR );
-					VpdException ve( "Out of memory." );
-					throw ve;
-				}
-
-				if( d->getID( ) != UNKNOWN_ID )
-				{
-					if( !mDevices.insert( make_pair( d->getID( ), d ) ).second )
-					{
-						delete d;
-					}
-				}
-				else
-				{
-					delete d;
+					mDevices.pop_back( );
 				}
 			}
 			else
@@ -97,16 +82,8 @@ namespace lsvpd
 				done = true;
 			}
 		}
-	}
 
-	Manufacturer::~Manufacturer( )
-	{
-		map<int,Device*>::iterator i, end;
-		for( i = mDevices.begin( ), end = mDevices.end( ); i != end; ++i )
-		{
-			Device* d = (*i).second;
-			delete( d );
-		}
+		sortByID( mDevices );
 	}
 
 	const Device* Manufacturer::getDevice( int id ) const
@@ -116,12 +93,12 @@ namespace lsvpd
 			return &Device::DEFAULT_DEV;
 		}
 
-		map<int,Device*>::const_iterator i = mDevices.find( id );
-		if( i == mDevices.end( ) )
+		const Device* d = findByID( mDevices, id );
+		if( d == NULL )
 		{
 			return &Device::DEFAULT_DEV;
 		}
 
-		return (*i).second;
+		return d;
 	}
 }
@@ -72,8 +72,4 @@ namespace lsvpd
 			mName = str;
 		}
 	}
-
-	SubDevice::~SubDevice( )
-	{
-	}
 }
@@ -54,7 +54,8 @@ namespace lsvpd
 	 * @author Eric Munson <munsone@us.ibm.com>, Brad Peters
 	 * <bpeters@us.ibm.com>
 	 */
-	Gatherer::Gatherer( bool limitSCSISize = false )
+	Gatherer::Gatherer( bool limitSCSISize = false,
+			    InquiryCacheMode cacheMode = CACHE_REUSE )
 	{
 		sources = vector<ICollector*>( );
 
@@ -62,7 +63,7 @@ namespace lsvpd
 		 * NOTE:  MUST MAINTAIN THIS ORDER!! sysFS called before Device-tree!
 		 * -----------------------------------------------------------*/
 		SysFSTreeCollector * sysFSTree =
-			new SysFSTreeCollector( limitSCSISize );
+			new SysFSTreeCollector( limitSCSISize, cacheMode );
 		if( sysFSTree->init( ) )
 		{
 			sources.push_back( sysFSTree );
@@ -130,6 +130,23 @@ namespace lsvpd
 		return ret;
 	}
 
+	string ICollector::trimAttr( const string& val )
+	{
+		string::size_type beg, end;
+		string ret;
+
+		beg = val.find_first_not_of( " \t\n" );
+		if( beg == string::npos )
+			return "";
+		end = val.find_last_not_of( " \t\n" );
+
+		ret = val.substr( beg, end - beg + 1 );
+		for( string::size_type i = 0; i < ret.length( ); i++ )
+			if( !isprint( (unsigned char) ret[ i ] ) )
+				ret[ i ] = '_';
+		return ret;
+	}
+
 	/*
 	 * Read a binary blob from given @path and store it in a string.
 	 * The string is returned by-value to the caller, and thus does
@@ -0,0 +1,278 @@
+/***************************************************************************
+ *   Copyright (C) 2006, IBM                                               *
+ *                                                                         *
+ *   Maintained by:                                                        *
+ *   Eric Munson and Brad Peters                                           *
+ *   munsone@us.ibm.com, bpeters@us.ibm.com                                *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <inquirycache.hpp>
+
+#include <libvpd-2/logger.hpp>
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+/*
+ * Cache file layout, one record per line:
+ *
+ *   lsvpd-inquiry-cache 1
+ *   S <stamp>
+ *   I <identity>
+ *   P <cmd> <evpd> <page code> <alloc> <ret> <hex data | ->
+ *   P ...
+ *   I <identity>
+ *   ...
+ *
+ * Each 'P' line belongs to the 'I' line above it.
+ */
+#define INQUIRY_CACHE_MAGIC "lsvpd-inquiry-cache 1"
+
+namespace lsvpd
+{
+	static string toHex( const string& data )
+	{
+		static const char digits[] = "0123456789abcdef";
+		string ret;
+
+		if( data.empty( ) )
+			return "-";
+
+		ret.reserve( data.length( ) * 2 );
+		for( string::size_type i = 0; i < data.length( ); i++ )
+		{
+			unsigned char c = data[ i ];
+			ret += digits[ c >> 4 ];
+			ret += digits[ c & 0xf ];
+		}
+		return ret;
+	}
+
+	static int hexVal( char c )
+	{
+		if( c >= '0' && c <= '9' )
+			return c - '0';
+		if( c >= 'a' && c <= 'f' )
+			return c - 'a' + 10;
+		if( c >= 'A' && c <= 'F' )
+			return c - 'A' + 10;
+		return -1;
+	}
+
+	static bool fromHex( const string& hex, string& data )
+	{
+		data.clear( );
+		if( hex == "-" )
+			return true;
+
+		if( hex.length( ) % 2 )
+			return false;
+
+		data.reserve( hex.length( ) / 2 );
+		for( string::size_type i = 0; i < hex.length( ); i += 2 )
+		{
+			int hi = hexVal( hex[ i ] ), lo = hexVal( hex[ i + 1 ] );
+			if( hi < 0 || lo < 0 )
+				return false;
+			data += (char)( ( hi << 4 ) | lo );
+		}
+		return true;
+	}
+
+	InquiryCache::InquiryCache( const string& path, const string& stamp,
+				    InquiryCacheMode mode ) :
+		mPath( path ), mStamp( stamp ), mMode( mode ), mUsed( false )
+	{
+		if( mMode != CACHE_IGNORE )
+			load( );
+	}
+
+	InquiryCache::~InquiryCache( )
+	{
+	}
+
+	void InquiryCache::load( )
+	{
+		ifstream in( mPath.c_str( ) );
+		string line, identity;
+		vector<InquiryPage>* pages = NULL;
+
+		if( !in )
+			return;
+
+		if( !getline( in, line ) || line != INQUIRY_CACHE_MAGIC )
+			return;
+
+		/*
+		 * A different template set or inquiry mode: drop everything,
+		 * unless the point is to parse the old data with new templates.
+		 */
+		if( !getline( in, line ) || line.compare( 0, 2, "S " ) != 0 )
+			return;
+		if( line != "S " + mStamp && mMode != CACHE_REPARSE )
+			return;
+
+		while( getline( in, line ) )
+		{
+			if( line.compare( 0, 2, "I " ) == 0 )
+			{
+				identity = line.substr( 2 );
+				pages = &mOld[ identity ];
+				pages->clear( );
+			}
+			else if( line.compare( 0, 2, "P " ) == 0 && pages != NULL )
+			{
+				istringstream is( line.substr( 2 ) );
+				InquiryPage page;
+				string hex;
+
+				is >> page.cmd >> page.evpd >> page.pageCode >>
+					page.alloc >> page.ret >> hex;
+				if( !is || !fromHex( hex, page.data ) )
+				{
+					/* Corrupt record, forget this device */
+					mOld.erase( identity );
+					pages = NULL;
+					continue;
+				}
+				pages->push_back( page );
+			}
+		}
+	}
+
+	bool InquiryCache::lookup( const string& identity,
+				   vector<InquiryPage>& pages )
+	{
+		map<string, vector<InquiryPage> >::iterator i;
+
+		if( identity.empty( ) )
+			return false;
+
+		mUsed = true;
+		i = mCurrent.find( identity );
+		if( i != mCurrent.end( ) )
+		{
+			pages = i->second;
+			return true;
+		}
+
+		i = mOld.find( identity );
+		if( i == mOld.end( ) )
+			return false;
+
+		/* Keep it for the next run too */
+		pages = i->second;
+		mCurrent[ identity ] = i->second;
+		return true;
+	}
+
+	void InquiryCache::update( const string& identity,
+				   const vector<InquiryPage>& pages )
+	{
+		if( identity.empty( ) )
+			return;
+
+		mUsed = true;
+		mCurrent[ identity ] = pages;
+	}
+
+	int InquiryCache::save( )
+	{
+		map<string, vector<InquiryPage> >::const_iterator i;
+		vector<InquiryPage>::const_iterator p;
+		string tmpPath = mPath + ".tmp";
+		ofstream out;
+
+		/* Nothing was probed, leave the previous cache alone */
+		if( !mUsed )
+			return 0;
+
+		out.open( tmpPath.c_str( ), ios::out | ios::trunc );
+		if( !out )
+		{
+			int err = errno;
+			Logger logger;
+			logger.log( "Unable to write inquiry cache " + tmpPath,
+				    LOG_WARNING );
+			return -err;
+		}
+
+		out << INQUIRY_CACHE_MAGIC << endl;
+		out << "S " << mStamp << endl;
+		for( i = mCurrent.begin( ); i != mCurrent.end( ); ++i )
+		{
+			out << "I " << i->first << endl;
+			for( p = i->second.begin( ); p != i->second.end( ); ++p )
+			{
+				out << "P " << p->cmd << " " << p->evpd << " " <<
+					p->pageCode << " " << p->alloc << " " <<
+					p->ret << " " << toHex( p->data ) << endl;
+			}
+		}
+
+		out.close( );
+		if( !out )
+		{
+			unlink( tmpPath.c_str( ) );
+			return -EIO;
+		}
+
+		/* Replace the old cache in one step so readers never see half */
+		if( rename( tmpPath.c_str( ), mPath.c_str( ) ) != 0 )
+		{
+			int err = errno;
+			unlink( tmpPath.c_str( ) );
+			return -err;
+		}
+
+		return 0;
+	}
+
+	const InquiryPage* InquiryCache::findPage(
+		const vector<InquiryPage>& pages, int cmd, int evpd,
+		int pageCode, int alloc )
+	{
+		vector<InquiryPage>::const_iterator p;
+
+		for( p = pages.begin( ); p != pages.end( ); ++p )
+		{
+			if( p->cmd == cmd && p->evpd == evpd &&
+			    p->pageCode == pageCode && p->alloc == alloc )
+				return &( *p );
+		}
+		return NULL;
+	}
+
+	string InquiryCache::fileStamp( const string& file )
+	{
+		struct stat info;
+		ostringstream os;
+
+		if( stat( file.c_str( ), &info ) != 0 )
+			return "none";
+
+		os << (long long)info.st_mtime << "." << (long)info.st_mtim.tv_nsec
+			<< ":" << (long long)info.st_size;
+		return os.str( );
+	}
+}
@@ -63,6 +63,7 @@
 #include <stdint.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <unistd.h>
 #include <libgen.h>
 #include <cerrno>
@@ -71,6 +72,7 @@
 #include <limits.h>
 
 #include <vector>
+#include <map>
 #include <algorithm>
 
 extern "C"
@@ -88,6 +90,10 @@ inline static string _errmsg(string line, string file, string str)
 
 #define errmsg(str) _errmsg(TOSTRING(__LINE__), __FILE__, str)
 
+/* Was page code listed in EVPD page 0?  Template page codes may be out of range */
+#define PAGE_SUPPORTED(map, code) \
+	((code) >= 0 && (code) < 256 && (map)[(code)])
+
 using namespace std;
 
 namespace lsvpd
@@ -95,11 +101,24 @@ namespace lsvpd
 
 	static const string SCSI_CDROM_DEFAULT ( "Other SCSI CD-ROM Drive" );
 
+	/*
+	 * A template pattern split on '*' once at load time, so matching a
+	 * device never has to re-walk or copy the pattern string.
+	 */
+	struct scsi_glob {
+		string prefix;		// Literal text before the first '*'
+		vector<string> parts;	// Literal runs following each '*'
+		bool wild;		// Pattern contains at least one '*'
+	};
+
 	struct scsi_template {
 		string vendor;
 		string devClass;
 		string model;
 		string format_str; //The format followed by ioctl data string
+		scsi_glob vendorGlob;
+		scsi_glob classGlob;
+		scsi_glob modelGlob;
 	};
 
 	struct intStr {
@@ -114,9 +133,85 @@ namespace lsvpd
 
 	static vector<scsi_template*> scsi_templates;
 
+	/*
+	 * One level of the template index.  Patterns without a '*' live in
+	 * 'exact', keyed by the whole pattern; wildcard patterns live in
+	 * 'prefixed', keyed by their literal text before the first '*'.  A
+	 * lookup therefore costs one probe per distinct prefix length rather
+	 * than one comparison per template.
+	 */
+	template <typename T>
+	struct scsi_glob_index {
+		map<string, T> exact;
+		map<string, T> prefixed;
+		vector<string::size_type> prefixLens;	// ascending, unique
+
+		T& slot(const scsi_glob& glob)
+		{
+			if (!glob.wild)
+				return exact[glob.prefix];
+
+			string::size_type len = glob.prefix.length();
+			if (!binary_search(prefixLens.begin(), prefixLens.end(), len))
+				prefixLens.insert(lower_bound(prefixLens.begin(),
+							      prefixLens.end(), len), len);
+			return prefixed[glob.prefix];
+		}
+
+		/* Collect every bucket whose key could match 'value' */
+		void candidates(const string& value, vector<const T*>& out) const
+		{
+			typename map<string, T>::const_iterator it;
+			vector<string::size_type>::const_iterator len;
+
+			it = exact.find(value);
+			if (it != exact.end())
+				out.push_back(&it->second);
+
+			for (len = prefixLens.begin(); len != prefixLens.end() &&
+			     *len <= value.length(); ++len) {
+				it = prefixed.find(value.substr(0, *len));
+				if (it != prefixed.end())
+					out.push_back(&it->second);
+			}
+		}
+	};
+
+	/* Template numbers (load order) per vendor -> class -> model bucket */
+	typedef vector<int> scsi_model_bucket;
+	typedef scsi_glob_index<scsi_model_bucket> scsi_model_index;
+	typedef scsi_glob_index<scsi_model_index> scsi_class_index;
+	static scsi_glob_index<scsi_class_index> scsi_template_index;
+
+	/* One field of an NVMe VPD buffer: keyword and where its bytes are */
+	struct nvme_field {
+		string name;
+		int offset;
+		int length;
+	};
+
 	struct nvme_template {
 		string log_page_version;
 		string format_str; // The format followed by f1h log page
+		string vendor; // PCI subsystem vendor glob, empty for any
+		vector<nvme_field> fields; // format_str compiled at load time
+	};
+
+	/* Fixed layout of the NVMe-MI VPD read (see interpretNVMEMiLog) */
+	static const struct {
+		const char *name;
+		int offset;
+		int length;
+	} nvme_mi_layout[] = {
+		{ "ID",   4, 40 }, { "PN",  44, 12 }, { "EC",  56, 10 },
+		{ "FN",  66, 12 }, { "AN",  78, 12 }, { "FC",  90,  4 },
+		{ "CC",  94,  4 }, { "SN",  98,  8 }, { "Z0", 106,  8 },
+		{ "Z1", 114,  4 }, { "Z2", 118, 10 }, { "Z3", 128, 12 },
+		{ "Z4", 140,  1 }, { "Z5", 141,  2 }, { "Z6", 143,  8 },
+		{ "Z7", 151,  3 }, { "Z8", 154,  5 }, { "Z9", 159,  2 },
+		{ "ZA", 161,  4 }, { "ZB", 165,  4 }, { "ZC", 169,  2 },
+		{ "MN", 171, 20 },
+		{ NULL,   0,  0 }
 	};
 	static vector<nvme_template*> nvme_templates;
 
@@ -420,27 +515,99 @@ namespace lsvpd
 		return NULL;
 	}
 
+	/**
+	 * Split a template pattern on '*' so it can be matched without
+	 * allocating.
+	 */
+	static void compileGlob(const string& pattern, scsi_glob& glob)
+	{
+		string::size_type beg, star;
+
+		glob.parts.clear();
+		star = pattern.find('*');
+		glob.wild = (star != string::npos);
+		glob.prefix = pattern.substr(0, star);
+
+		while (star != string::npos) {
+			beg = star + 1;
+			star = pattern.find('*', beg);
+			if (star != beg)
+				glob.parts.push_back(pattern.substr(beg, star - beg));
+		}
+	}
+
+	/**
+	 * Match a compiled pattern, with the same rules as matches(): text
+	 * before the first '*' must be a prefix of str, and the literal runs
+	 * that follow must appear, in order, somewhere after it.  A pattern
+	 * with no '*' must equal str.
+	 */
+	static bool globMatches(const scsi_glob& glob, const string& str)
+	{
+		string::size_type pos;
+		vector<string>::const_iterator part;
+
+		if (!glob.wild)
+			return str == glob.prefix;
+
+		if (str.compare(0, glob.prefix.length(), glob.prefix) != 0)
+			return false;
+
+		pos = glob.prefix.length();
+		for (part = glob.parts.begin(); part != glob.parts.end(); ++part) {
+			pos = str.find(*part, pos);
+			if (pos == string::npos)
+				return false;
+			pos += part->length();
+		}
+
+		return true;
+	}
+
 	/**
 	 * Attempts to match a template specification to device discovered
-	 * values.
+	 * values.  Only the index buckets that can match vendor, devClass and
+	 * model are visited; among the matches the template listed first in
+	 * the file wins, as it always has.
 	 */
-	const scsi_template *findTemplate(string vendor,
-					  string devClass, string model)
+	const scsi_template *findTemplate(const string& vendor,
+					  const string& devClass,
+					  const string& model)
 	{
-		vector<scsi_template*>::iterator i, end;
+		vector<const scsi_class_index*> classes;
+		vector<const scsi_model_index*> models;
+		vector<const scsi_model_bucket*> buckets;
+		int best = -1;
 
-		for ( i = scsi_templates.begin( ), end = scsi_templates.end( ); i != end; ++i ) {
-			if (!matches((*i)->vendor, vendor))
-				continue;
-			if (!matches((*i)->devClass, devClass))
-				continue;
-			if (!matches((*i)->model, model))
-				continue;
+		scsi_template_index.candidates(vendor, classes);
+		for (size_t c = 0; c < classes.size(); c++)
+			classes[c]->candidates(devClass, models);
+		for (size_t m = 0; m < models.size(); m++)
+			models[m]->candidates(model, buckets);
 
-			return *i;
+		for (size_t b = 0; b < buckets.size(); b++) {
+			const scsi_model_bucket& bucket = *buckets[b];
+
+			/* Buckets hold template numbers in ascending order */
+			for (size_t i = 0; i < bucket.size(); i++) {
+				const scsi_template *t = scsi_templates[bucket[i]];
+
+				if (best != -1 && bucket[i] >= best)
+					break;
+
+				if (globMatches(t->vendorGlob, vendor) &&
+				    globMatches(t->classGlob, devClass) &&
+				    globMatches(t->modelGlob, model)) {
+					best = bucket[i];
+					break;
+				}
+			}
 		}
 
-		return NULL;
+		if (best == -1)
+			return NULL;
+
+		return scsi_templates[best];
 	}
 
 	string lsvpd_hexify(const unsigned char * str,
@@ -650,13 +817,12 @@ namespace lsvpd
 
 	/**
 	 * Takes a char * pointer, removing all spaces before and after,
-	 * then copying up fieldSize bytes with Null termination added
+	 * then copying up fieldSize bytes into result.  Reusing one result
+	 * string from field to field avoids an allocation per field.
 	 */
-	string strdupTrim(char *buf, int maxLen)
+	void trimInto(const char *buf, int maxLen, string& result)
 	{
 		int beg, end;
-		string result;
-		char *tmp;
 
 		beg = 0;
 		while	(beg < maxLen &&
@@ -667,13 +833,7 @@ namespace lsvpd
 		while	(end > beg && buf[end] == 32)
 			end--;
 
-		tmp = strndup(buf + beg, end - beg);
-		if (!tmp)
-			return NULL;
-
-		result = string(tmp);
-		free(tmp);
-		return result;
+		result.assign(buf + beg, strnlen(buf + beg, end - beg));
 	}
 
 	/**
@@ -721,7 +881,7 @@ namespace lsvpd
 			fieldName = getFieldName(fieldTemplate);
 			fieldSize = getFieldValue(fieldTemplate);
 
-			dataVal = strdupTrim(data + dataCurLoc, fieldSize);
+			trimInto(data + dataCurLoc, fieldSize, dataVal);
 			//coutd << "	fieldTemplate = " << fieldTemplate << " ,fieldName = "
 			//<< fieldName << ", fieldSize = " << fieldSize
 			//<< ", Dataval =  " << dataVal << endl;
@@ -831,44 +991,132 @@ namespace lsvpd
 		return 0;
 	}
 
+	/* Canonical form of a sysfs path, so links and real paths compare equal */
+	static string resolvedPath( const string& path )
+	{
+		char buf[PATH_MAX];
+
+		if (realpath(path.c_str(), buf) == NULL)
+			return "";
+		return string(buf);
+	}
+
 	/*
-	 * device_open function opens device node under
-	 * /dev using AIXName of device.
+	 * Open a device node by type and number through udev's /dev/char
+	 * and /dev/block links.
 	 * return   : file descriptor in success, and -ERRNO in failure.
 	 */
-	int device_open(Component* fillMe)
+	static int device_open_link(mode_t type, int major, int minor)
 	{
-		bool found = false;
-		int device_fd = -1;
+		dev_t devno = makedev(major, minor);
 		struct stat statbuf;
-		string dev_path;
+		ostringstream os;
+		int device_fd;
 
-		vector <DataItem*> aixNames = fillMe->getAIXNames();
-		vector<DataItem*>::const_iterator i, end;
+		os << (type == S_IFBLK ? "/dev/block/" : "/dev/char/")
+		   << major << ":" << minor;
 
-		i = aixNames.begin();
-		end = aixNames.end();
+		device_fd = open(os.str().c_str(), O_RDONLY | O_NONBLOCK);
+		if (device_fd < 0)
+			return -UNABLE_TO_OPEN_FILE;
 
-		while (i != end) {
-			dev_path = "/dev/" + (*i)->getValue();
-			i++;
+		if (fstat(device_fd, &statbuf) == 0 &&
+		    (statbuf.st_mode & S_IFMT) == type &&
+		    statbuf.st_rdev == devno)
+			return device_fd;
 
-			if (stat(dev_path.c_str(), &statbuf) == 0) {
-				found = true;
-				break;
-			}
+		close(device_fd);
+		return -UNABLE_TO_OPEN_FILE;
+	}
+
+	/*
+	 * Open a device node by type and number when there is no node for
+	 * it yet (before udev has run, in early boot).  A private node is
+	 * made under DEVICE_NODE_TMPDIR and removed again as soon as it is
+	 * open.
+	 * return   : file descriptor in success, and -ERRNO in failure.
+	 */
+	static int device_open_mknod(mode_t type, int major, int minor)
+	{
+		char dir[] = DEVICE_NODE_TMPDIR "/.lsvpd.XXXXXX";
+		string node;
+		int device_fd;
+
+		if (mkdtemp(dir) == NULL)
+			return -UNABLE_TO_MKNOD_FILE;
+
+		node = string(dir) + "/dev";
+		if (mknod(node.c_str(), type | S_IRUSR | S_IWUSR,
+			  makedev(major, minor)) != 0) {
+			rmdir(dir);
+			return -UNABLE_TO_MKNOD_FILE;
 		}
 
-		if (!found)
-			return -UNABLE_TO_OPEN_FILE;
+		device_fd = open(node.c_str(), O_RDONLY | O_NONBLOCK);
+		unlink(node.c_str());
+		rmdir(dir);
 
-		device_fd = open(dev_path.c_str(), 0);
 		if (device_fd < 0)
 			return -UNABLE_TO_OPEN_FILE;
 
 		return device_fd;
 	}
 
+	/*
+	 * Open a device node by type and number, through udev's links or
+	 * failing that a private node.
+	 * return   : file descriptor in success, and -ERRNO in failure.
+	 */
+	static int device_open_number(mode_t type, int major, int minor)
+	{
+		int device_fd = device_open_link(type, major, minor);
+
+		if (device_fd >= 0)
+			return device_fd;
+
+		return device_open_mknod(type, major, minor);
+	}
+
+	/*
+	 * device_open function opens the device node for a component, by
+	 * the major:minor number get_mm_scsi() and friends recorded when
+	 * there is one, and by the AIXName of device under /dev otherwise.
+	 * A private node is only made when neither exists.
+	 * return   : file descriptor in success, and -ERRNO in failure.
+	 */
+	int device_open(Component* fillMe)
+	{
+		mode_t type = fillMe->devAccessMode & S_IFMT;
+		bool byNumber = fillMe->devMajor > 0 &&
+			(type == S_IFCHR || type == S_IFBLK);
+		int device_fd = -1;
+		string dev_path;
+
+		if (byNumber) {
+			device_fd = device_open_link(type, fillMe->devMajor,
+						     fillMe->devMinor);
+			if (device_fd >= 0)
+				return device_fd;
+		}
+
+		const vector<DataItem*>& aixNames = fillMe->getAIXNames();
+		vector<DataItem*>::const_iterator i;
+
+		for (i = aixNames.begin(); i != aixNames.end(); ++i) {
+			dev_path = "/dev/" + (*i)->getValue();
+
+			device_fd = open(dev_path.c_str(), O_RDONLY | O_NONBLOCK);
+			if (device_fd >= 0)
+				return device_fd;
+		}
+
+		if (byNumber)
+			return device_open_mknod(type, fillMe->devMajor,
+						 fillMe->devMinor);
+
+		return -UNABLE_TO_OPEN_FILE;
+	}
+
 	/* Calculate the length of the response from SG Utils */
 	static int
 		device_scsi_sg_resp_len(bool evpd, char *device_sg_read_buffer,
@@ -1027,6 +1275,105 @@ namespace lsvpd
 		return len;
 	}
 
+	/*
+	 * Callers clear a buffer before each query, so everything past the
+	 * last non-zero byte is known and need not be kept.
+	 */
+	static string usedBytes(const char *buffer, int size)
+	{
+		while (size > 0 && buffer[size - 1] == '\0')
+			size--;
+		return string(buffer, size);
+	}
+
+	/**
+	 * @brief: Query one page, either from the device or from pages
+	 *	recorded earlier for the same LUN.
+	 * @arg device_fd: Device to query, or -1 if it isn't open
+	 * @arg openMe: If set and device_fd isn't open, the component whose
+	 *	device is opened into device_fd the first time a page has to
+	 *	be read from it.  Cleared once that has been tried.
+	 * @arg pages: Recorded pages.  When replay is set the page is looked
+	 *	up here first; a page read from the device is appended.  May be
+	 *	NULL to query without recording.
+	 * @arg alloc: Allocation length for a plain sg_ll_inquiry, or 0 to
+	 *	let doSGQuery size the request.
+	 */
+	static int fetchPage(int& device_fd, Component *&openMe,
+			     vector<InquiryPage> *pages, bool replay,
+			     char *buffer, int alloc, int evpd, int page_code,
+			     int cmd = 0)
+	{
+		InquiryPage page;
+		int ret;
+
+		if (pages != NULL && replay) {
+			const InquiryPage *p = InquiryCache::findPage(*pages, cmd,
+						evpd, page_code, alloc);
+
+			if (p != NULL) {
+				memcpy(buffer, p->data.data(), p->data.length());
+				return p->ret;
+			}
+		}
+
+		if (device_fd < 0 && openMe != NULL) {
+			device_fd = device_open(openMe);
+			openMe = NULL;
+		}
+
+		if (device_fd < 0)
+			return -UNABLE_TO_OPEN_FILE;
+
+		if (alloc)
+			ret = sg_ll_inquiry(device_fd, cmd, evpd, page_code,
+					    buffer, alloc, 1, 0);
+		else
+			ret = doSGQuery(device_fd, buffer, MAXBUFSIZE, evpd,
+					page_code, cmd);
+
+		if (pages == NULL)
+			return ret;
+
+		page.cmd = cmd;
+		page.evpd = evpd;
+		page.pageCode = page_code;
+		page.alloc = alloc;
+		page.ret = ret;
+		page.data = usedBytes(buffer, MAXBUFSIZE);
+		pages->push_back(page);
+
+		return ret;
+	}
+
+	/*
+	 * Record the enclosure slot found for a disk with its pages,
+	 * replacing the one recorded by an earlier run, so that replaying
+	 * them gives the disk the same location without RECEIVE DIAGNOSTIC.
+	 */
+	static void recordSlot(vector<InquiryPage> *pages, const string& slot)
+	{
+		vector<InquiryPage>::iterator i;
+		InquiryPage page;
+
+		if (pages == NULL || slot.empty())
+			return;
+
+		for (i = pages->begin(); i != pages->end(); )
+			if (i->cmd == RAW_SCSI_SLOT)
+				i = pages->erase(i);
+			else
+				++i;
+
+		page.cmd = RAW_SCSI_SLOT;
+		page.evpd = 0;
+		page.pageCode = 0;
+		page.alloc = 0;
+		page.ret = 0;
+		page.data = slot;
+		pages->push_back(page);
+	}
+
 	/* load_scsi_templates
 	 * @brief Loads scsi templates, used for parsing sg_utils return
 	 *   data, from filesystem
@@ -1062,14 +1409,88 @@ namespace lsvpd
 			HelperFunctions::parseString(line, 3, tmp->model);
 			HelperFunctions::parseString(line, 4, tmp->format_str);
 
+			compileGlob(tmp->vendor, tmp->vendorGlob);
+			compileGlob(tmp->devClass, tmp->classGlob);
+			compileGlob(tmp->model, tmp->modelGlob);
+
 			dev_count++;
 
+			/* Index by the position in file to keep first-match-wins */
+			scsi_template_index.slot(tmp->vendorGlob)
+				.slot(tmp->classGlob)
+				.slot(tmp->modelGlob)
+				.push_back(scsi_templates.size());
+
 			scsi_templates.push_back(tmp);
 			scsi_template_count++;
 		}
 		return 0;
 	}
 
+	/**
+	 * @brief: Turn an f1h format string into a field table once, at load
+	 *	time, instead of re-tokenizing it for every device.  The first
+	 *	entry covers the 4 byte version and is skipped.
+	 */
+	static void compileNvmeFormat(const string& format,
+				      vector<nvme_field>& fields)
+	{
+		string::size_type beg, end;
+		nvme_field field;
+		int offset = 4;	// Skip the version string which 4 characters wide
+
+		beg = format.find(',');
+		while (beg != string::npos) {
+			beg++;
+			end = format.find(',', beg);
+			string fieldTemplate = format.substr(beg,
+				end == string::npos ? string::npos : end - beg);
+
+			field.name = getFieldName(fieldTemplate);
+			field.offset = offset;
+			field.length = getFieldValue(fieldTemplate);
+			offset += field.length;
+
+			/* Malformed or past the end of the log page */
+			if (field.length > 0 &&
+			    field.offset + field.length < NVME_VPD_INFO_SIZE)
+				fields.push_back(field);
+
+			beg = end;
+		}
+	}
+
+	/**
+	 * @brief: Load nvme_templates.conf if that hasn't happened yet, and
+	 *	check whether an f1h log page template applies to a controller.
+	 *	A template naming a vendor only applies to controllers whose
+	 *	PCI subsystem vendor matches it, so other drives aren't asked
+	 *	for a page nothing here can decode.
+	 * @arg ctrlDir: sysfs directory of the controller (.../nvme/nvmeN)
+	 * @return true if there is at least one template for it
+	 */
+	bool SysFSTreeCollector::haveNvmeTemplates( const string& ctrlDir )
+	{
+		vector<nvme_template*>::const_iterator i;
+		string vendor;
+
+		if (nvme_templates.size() == 0 &&
+		    load_nvme_templates(NVME_TEMPLATES_FILE) != 0)
+			return false;
+
+		vendor = trimAttr(getAttrValue(ctrlDir + "/device",
+					       "subsystem_vendor"));
+		if (vendor.compare(0, 2, "0x") == 0)
+			vendor = vendor.substr(2);
+
+		for (i = nvme_templates.begin(); i != nvme_templates.end(); ++i)
+			if ((*i)->vendor.empty() ||
+			    (!vendor.empty() && matches((*i)->vendor, vendor)))
+				return true;
+
+		return false;
+	}
+
 	int SysFSTreeCollector::load_nvme_templates(const string& filename)
 	{
 		char tmp_line[512]; // version 0001 has 136 characters, good size for future
@@ -1099,6 +1520,17 @@ namespace lsvpd
 
 			HelperFunctions::parseString(line, 1, tmp->log_page_version);
 			HelperFunctions::parseString(line, 2, tmp->format_str);
+			HelperFunctions::parseString(line, 3, tmp->vendor);
+
+			/* Blank line, e.g. the one after the last newline */
+			if (tmp->log_page_version.empty()) {
+				delete tmp;
+				continue;
+			}
+
+			transform(tmp->vendor.begin(), tmp->vendor.end(),
+				  tmp->vendor.begin(), ::tolower);
+			compileNvmeFormat(tmp->format_str, tmp->fields);
 
 			nvme_templates.push_back(tmp);
 		}
@@ -1109,106 +1541,21 @@ namespace lsvpd
 int SysFSTreeCollector::interpretNVMEMiLog(Component *fillMe, char *data)
 {
 	string val;
-	val = strdupTrim(data + 4, 40);
-	if (val.length() > 0)
-		setVPDField(fillMe, "ID", val, __FILE__, __LINE__);
-
-	val = strdupTrim(data + 44, 12);
-	if (val.length() > 0)
-		setVPDField(fillMe, "PN", val, __FILE__, __LINE__);
-
-	val = strdupTrim(data + 56, 10);
-	if (val.length() > 0)
-		setVPDField(fillMe, "EC", val, __FILE__, __LINE__);
-
-	val = strdupTrim(data + 66, 12);
-	if (val.length() > 0)
-		setVPDField(fillMe, "FN", val, __FILE__, __LINE__);
-
-	val = strdupTrim(data + 78, 12);
-	if (val.length() > 0)
-		setVPDField(fillMe, "AN", val, __FILE__, __LINE__);
-
-	val = strdupTrim(data + 90, 4);
-	if (val.length() > 0)
-		setVPDField(fillMe, "FC", val, __FILE__, __LINE__);
-
-	val = strdupTrim(data + 94, 4);
-	if (val.length() > 0)
-		setVPDField(fillMe, "CC", val, __FILE__, __LINE__);
 
-	val = strdupTrim(data + 98, 8);
-	if (val.length() > 0)
-		setVPDField(fillMe, "SN", val, __FILE__, __LINE__);
-
-	val = strdupTrim(data + 106, 8);
-	if (val.length() > 0)
-		setVPDField(fillMe, "Z0", val, __FILE__, __LINE__);
-
-	val = strdupTrim(data + 114, 4);
-	if (val.length() > 0)
-		setVPDField(fillMe, "Z1", val, __FILE__, __LINE__);
-
-	val = strdupTrim(data + 118, 10);
-	if (val.length() > 0)
-		setVPDField(fillMe, "Z2", val, __FILE__, __LINE__);
-
-	val = strdupTrim(data + 128, 12);
-	if (val.length() > 0)
-		setVPDField(fillMe, "Z3", val, __FILE__, __LINE__);
-
-	val = strdupTrim(data + 140, 1);
-	if (val.length() > 0)
-		setVPDField(fillMe, "Z4", val, __FILE__, __LINE__);
-
-	val = strdupTrim(data + 141, 2);
-	if (val.length() > 0)
-		setVPDField(fillMe, "Z5", val, __FILE__, __LINE__);
-
-	val = strdupTrim(data + 143, 8);
-	if (val.length() > 0)
-		setVPDField(fillMe, "Z6", val, __FILE__, __LINE__);
-
-	val = strdupTrim(data + 151, 3);
-	if (val.length() > 0)
-		setVPDField(fillMe, "Z7", val, __FILE__, __LINE__);
-
-	val = strdupTrim(data + 154, 5);
-	if (val.length() > 0)
-		setVPDField(fillMe, "Z8", val, __FILE__, __LINE__);
-
-	val = strdupTrim(data + 159, 2);
-	if (val.length() > 0)
-		setVPDField(fillMe, "Z9", val, __FILE__, __LINE__);
-
-	val = strdupTrim(data + 161, 4);
-	if (val.length() > 0)
-		setVPDField(fillMe, "ZA", val, __FILE__, __LINE__);
-
-	val = strdupTrim(data + 165, 4);
-	if (val.length() > 0)
-		setVPDField(fillMe, "ZB", val, __FILE__, __LINE__);
-
-	val = strdupTrim(data + 169, 2);
-	if (val.length() > 0)
-		setVPDField(fillMe, "ZC", val, __FILE__, __LINE__);
-
-	val = strdupTrim(data + 171, 20);
-	if (val.length() > 0)
-		setVPDField(fillMe, "MN", val, __FILE__, __LINE__);
+	for (int i = 0; nvme_mi_layout[i].name != NULL; i++) {
+		trimInto(data + nvme_mi_layout[i].offset,
+			 nvme_mi_layout[i].length, val);
+		if (val.length() > 0)
+			setVPDField(fillMe, nvme_mi_layout[i].name, val,
+				    __FILE__, __LINE__);
+	}
 	return 0;
 }
 
         int SysFSTreeCollector::interpretNVMEf1hLogPage(Component *fillMe, char *data)
 	{
-		int eof[50]; // version 0001 has 24 ',' separated fields, more for future
-		int fieldTotal = 0;
-		int fieldNum;
-		int tempCurLoc, dataCurLoc;
-		string fieldTemplate;
-		string fieldName;
-		int fieldSize;
-		string dataVal;  // Data as read from data stream for single field
+		vector<nvme_field>::const_iterator field;
+		string version, dataVal;
 		ostringstream err;
 		Logger logger;
 		int rc;
@@ -1220,12 +1567,7 @@ int SysFSTreeCollector::interpretNVMEMiLog(Component *fillMe, char *data)
 		}
 
 		// The first 4 characters specify the version
-		string version = strdupTrim(data, 4);
-		if (version.c_str() == NULL) {
-			err << "Failed to allocate memory";
-			logger.log(err.str(), LOG_NOTICE);
-			return -1;
-		}
+		trimInto(data, 4, version);
 
 		const nvme_template *logPageTemplate = findNVMeTemplate(version);
 		// No template - unknown device
@@ -1236,53 +1578,16 @@ int SysFSTreeCollector::interpretNVMEMiLog(Component *fillMe, char *data)
 			return -1;
 		}
 
-		string *format = new string(logPageTemplate->format_str);
-		if (format == NULL) {
-			err << "Cannot allocate memory for NVMe format string";
-			logger.log(err.str( ), LOG_NOTICE);
-			return -ENOMEM;
-		}
-
-		for (int i = 0; i < (int) (*format).length(); i++) {
-			if ((*format)[i] == ',') {
-				eof[fieldTotal] = i;
-				fieldTotal++;
-			}
-		}
-
-		if (fieldTotal > 0) {
-			eof[fieldTotal] = logPageTemplate->format_str.length();
-			fieldTotal++;
-		}
-
-		// Walk each field in the template, grabbing data as we go
-		tempCurLoc = 4; // Skip the version specifier, ie "_:4,"
-		dataCurLoc = 4; // Skip the version string which 4 characters wide
-		fieldNum = 1;
-		while (fieldNum < fieldTotal) {
-			fieldTemplate = (*format).substr(tempCurLoc,
-							eof[fieldNum] - tempCurLoc);
-
-			fieldName = getFieldName(fieldTemplate);
-			fieldSize = getFieldValue(fieldTemplate);
-
-			dataVal = strdupTrim(data + dataCurLoc, fieldSize);
-			if (dataVal.c_str() == NULL )  {
-				delete format;
-				return -ENOMEM;
-			}
-
-			dataCurLoc += fieldSize;
-			tempCurLoc = eof[fieldNum] + 1;
-			fieldNum++;
-			if (dataVal.length() == 0) {
+		// Walk each field compiled from the template
+		for (field = logPageTemplate->fields.begin();
+		     field != logPageTemplate->fields.end(); ++field) {
+			trimInto(data + field->offset, field->length, dataVal);
+			if (dataVal.length() == 0)
 				continue;
-			}
 
-			setVPDField(fillMe, fieldName, dataVal , __FILE__, __LINE__);
+			setVPDField(fillMe, field->name, dataVal, __FILE__, __LINE__);
 		}
 
-		delete format;
 		return 0;
 	}
 
@@ -1343,19 +1648,215 @@ int nvme_read_mi_vpd(int device_fd, void *buf)
 		return ret;
 	}
 
+	/* Controllers read by the NVMe read-ahead threads */
+	struct nvme_prefetch_queue {
+		vector<string> devs;		/* "major:minor" of each controller */
+		vector<NvmeVpdData> results;	/* Same order as devs */
+	};
+
+	static void nvme_prefetch_one(unsigned int idx, void *arg)
+	{
+		struct nvme_prefetch_queue *q = (struct nvme_prefetch_queue *) arg;
+		char data[NVME_VPD_INFO_SIZE];
+		char mi_data[NVME_MI_VPD_DATA_LEN];
+		int major, minor, device_fd;
+
+		NvmeVpdData &res = q->results[idx];
+		if (sscanf(q->devs[idx].c_str(), "%d:%d", &major, &minor) != 2)
+			return;
+
+		device_fd = device_open_number(S_IFCHR, major, minor);
+		if (device_fd < 0)
+			return;
+
+		memset(data, '\0', sizeof(data));
+		res.f1hRc = nvme_read_vpd(device_fd, data);
+		res.f1h = usedBytes(data, sizeof(data));
+
+		if (res.f1hRc != 0) {
+			memset(mi_data, '\0', sizeof(mi_data));
+			res.miRc = nvme_read_mi_vpd(device_fd, mi_data);
+			res.mi = usedBytes(mi_data, sizeof(mi_data));
+			res.miRead = true;
+		}
+
+		res.f1hRead = true;
+		close(device_fd);
+	}
+
+	/**
+	 * @brief: Read the VPD of every NVMe controller in the system at once,
+	 *	before the fill pass asks for them one at a time.  A small pool
+	 *	of threads each issues the blocking admin commands for one
+	 *	controller at a time, so a system with dozens of drives waits
+	 *	for the slowest few rather than for all of them in turn.
+	 */
+	void SysFSTreeCollector::prefetchNvmeVpd( )
+	{
+		string base = "/sys/class/nvme";
+		struct nvme_prefetch_queue q;
+		vector<string> ctrls, keys;
+		unsigned int i;
+		NvmeVpdData none;
+
+		mNvmePrefetched = true;
+
+		/* Nothing is read from the devices when reparsing */
+		if (mInquiryCache != NULL && mInquiryCache->reparse())
+			return;
+
+		fsw.fs_getDirContents(base, '*', ctrls);
+		for (i = 0; i < ctrls.size(); i++) {
+			string key = getNvmeControllerKey(base + "/" + ctrls[i]);
+			string dev = getAttrValue(base + "/" + ctrls[i], "dev");
+
+			/* Multipath: the same controller listed again */
+			if (key.empty() || dev.empty() ||
+			    find(keys.begin(), keys.end(), key) != keys.end())
+				continue;
+			keys.push_back(key);
+			q.devs.push_back(dev);
+		}
+
+		if (q.devs.empty())
+			return;
+
+		none.f1hRead = false;
+		none.f1hRc = none.miRc = -1;
+		none.miRead = false;
+		q.results.assign(q.devs.size(), none);
+		runBounded(q.devs.size(), NVME_PREFETCH_THREADS,
+			   nvme_prefetch_one, &q);
+
+		for (i = 0; i < keys.size(); i++)
+			if (q.results[i].f1hRead)
+				mNvmeVpd[keys[i]] = q.results[i];
+	}
+
+	/**
+	 * @brief: Key NVMe VPD is kept under for the run.  A controller is
+	 *	named by its subsystem NQN and controller ID, which stay the
+	 *	same whichever PCI function, class node or multipath path it is
+	 *	reached through; its sysfs path is the fallback.
+	 * @return the key, or an empty string if ctrlDir doesn't exist
+	 */
+	string SysFSTreeCollector::getNvmeControllerKey( const string& ctrlDir )
+	{
+		string nqn, cntlid;
+
+		if (ctrlDir.empty())
+			return "";
+
+		nqn = getAttrValue(ctrlDir, "subsysnqn");
+		cntlid = getAttrValue(ctrlDir, "cntlid");
+		if (!nqn.empty() && !cntlid.empty())
+			return nqn + " " + cntlid;
+
+		return resolvedPath(ctrlDir);
+	}
+
+	/**
+	 * @brief: Read one of the NVMe VPD buffers, or take it from the
+	 *	inquiry cache when reparsing; a reparse never reads it.  Each controller is only asked once
+	 *	per run: prefetchNvmeVpd reads them all ahead, and anything read
+	 *	here is kept for the other routes to the same controller (PCI
+	 *	function, nvme class node, other multipath paths).  Whatever is
+	 *	read is stored in the cache for a later reparse.
+	 * @arg identity: NVMe controller identity, see getNvmeIdentity
+	 * @arg ctrlDir: sysfs directory of the controller
+	 * @arg kind: RAW_NVME_F1H_LOG or RAW_NVME_MI_VPD
+	 * @return 0 if buf holds valid data
+	 */
+	int SysFSTreeCollector::readNvmeVpd(const string& identity,
+					    const string& ctrlDir, int device_fd,
+					    int kind, char *buf, int len)
+	{
+		map<string, NvmeVpdData>::iterator ahead;
+		string data, key;
+		int rc;
+
+		memset(buf, '\0', len);
+		if (storedRawData(identity, kind, data, rc)) {
+			memcpy(buf, data.data(), min((int) data.length(), len));
+			return rc;
+		}
+
+		/* Reparsing: nothing stored, and the device isn't asked */
+		if (mInquiryCache != NULL && mInquiryCache->reparse())
+			return -1;
+
+		if (!mNvmePrefetched)
+			prefetchNvmeVpd();
+
+		key = getNvmeControllerKey(ctrlDir);
+		if (key.empty()) {
+			if (kind == RAW_NVME_F1H_LOG)
+				rc = nvme_read_vpd(device_fd, buf);
+			else
+				rc = nvme_read_mi_vpd(device_fd, buf);
+
+			storeRawData(identity, kind, usedBytes(buf, len), rc);
+			return rc;
+		}
+
+		ahead = mNvmeVpd.find(key);
+		if (ahead == mNvmeVpd.end()) {
+			NvmeVpdData none;
+
+			none.f1hRead = none.miRead = false;
+			none.f1hRc = none.miRc = -1;
+			ahead = mNvmeVpd.insert(make_pair(key, none)).first;
+		}
+		NvmeVpdData &memo = ahead->second;
+
+		if (kind == RAW_NVME_F1H_LOG) {
+			if (!memo.f1hRead) {
+				memo.f1hRc = nvme_read_vpd(device_fd, buf);
+				memo.f1h = usedBytes(buf, len);
+				memo.f1hRead = true;
+			}
+			data = memo.f1h;
+			rc = memo.f1hRc;
+		} else {
+			if (!memo.miRead) {
+				memo.miRc = nvme_read_mi_vpd(device_fd, buf);
+				memo.mi = usedBytes(buf, len);
+				memo.miRead = true;
+			}
+			data = memo.mi;
+			rc = memo.miRc;
+		}
+
+		storeRawData(identity, kind, data, rc);
+		memcpy(buf, data.data(), min((int) data.length(), len));
+		return rc;
+	}
+
 	int SysFSTreeCollector::collectNvmeVpd(Component *fillMe, int device_fd)
 	{
 		int rc;
 		char data[NVME_VPD_INFO_SIZE];
 		char mi_data[NVME_MI_VPD_DATA_LEN];
+		string base = fillMe->sysFsNode.getValue() + "/nvme";
+		vector<string> ctrls;
+		string identity, ctrlDir;
+
+		/* The controller under this PCI function carries its identity */
+		fsw.fs_getDirContents(base, 'd', ctrls);
+		if (!ctrls.empty()) {
+			ctrlDir = base + "/" + ctrls[0];
+			identity = getNvmeIdentity(ctrlDir);
+		}
 
-		rc = nvme_read_vpd(device_fd, data);
+		rc = readNvmeVpd(identity, ctrlDir, device_fd, RAW_NVME_F1H_LOG,
+				 data, NVME_VPD_INFO_SIZE);
 		if (rc == 0) {
 			rc = interpretNVMEf1hLogPage(fillMe, data);
 			return rc;
 		}
 
-		rc = nvme_read_mi_vpd(device_fd, mi_data);
+		rc = readNvmeVpd(identity, ctrlDir, device_fd, RAW_NVME_MI_VPD,
+				 mi_data, NVME_MI_VPD_DATA_LEN);
 		if (rc == 0) {
 			rc = interpretNVMEMiLog(fillMe, mi_data);
 			return rc;
@@ -1381,13 +1882,19 @@ int nvme_read_mi_vpd(int device_fd, void *buf)
 	 * them, described by the template.
 	 *
 	 * @arg fillMe: Component to be queried
-	 * @arg device_fd: File pointer to mknod'd device file
-	 * @arg **device_sg_read_buffer: A pointer which will, upon return,
-	 * 	point to a new'd region of memory.  Must be deleted by caller.
+	 * @arg device_fd: File pointer to mknod'd device file, or -1
+	 * @arg pages: Pages recorded for this device, see fetchPage
+	 * @arg mayOpen: Open the device into device_fd, for the caller to
+	 *	close, only if a page has to be read that isn't in pages
 	 */
 
-	int SysFSTreeCollector::collectVpd(Component *fillMe, int device_fd, bool limitSCSISize)
+	int SysFSTreeCollector::collectVpd(Component *fillMe, int& device_fd,
+					   bool limitSCSISize,
+					   vector<InquiryPage> *pages, bool replay,
+					   bool mayOpen)
 	{
+		Component *openMe = mayOpen ? fillMe : NULL;
+		bool live = device_fd >= 0 || mayOpen;	/* Not only replaying */
 		int evpd;
 		int i, len = 0;
 		char buffer[MAXBUFSIZE];
@@ -1398,13 +1905,19 @@ int nvme_read_mi_vpd(int device_fd, void *buf)
 		int pageCodeInt;
 		int rc;
 		char vendor[32], model[32], firmware[32];
-		std::vector<int> byteValues;
+		bool pageSupported[256];	/* Indexed by EVPD page code */
+		int stdLen;
+		char peripheral;
 
 		if ((fillMe->devBus.getValue()).empty()) {
 			if ((fillMe->getDevClass() == "nvme")) {
 				char data[NVME_VPD_INFO_SIZE];
 
-				rc = nvme_read_vpd(device_fd, data);
+				string ctrlDir = fillMe->sysFsNode.getValue();
+
+				rc = readNvmeVpd(getNvmeIdentity(ctrlDir), ctrlDir,
+						 device_fd, RAW_NVME_F1H_LOG, data,
+						 NVME_VPD_INFO_SIZE);
 				if (rc)
 					return rc;
 
@@ -1431,16 +1944,23 @@ int nvme_read_mi_vpd(int device_fd, void *buf)
 				return -SCSI_FILL_TEMPLATE_LOADING;
 		}
 
-		/* Check for scsi devices */
-		if (fillMe->devBus.getValue() == "scsi") {
+		/* Check for scsi devices, unless the pages come from the cache */
+		if (fillMe->devBus.getValue() == "scsi" && device_fd >= 0 &&
+		    !replay) {
 			res = ioctl(device_fd, SG_GET_SCSI_ID, &sg_dat);
 			if (res < 0) {
 				return -SGUTILS_IOCTL_FAILED;
 			}
 		}
 
+		/*
+		 * Standard inquiry, read once: it identifies the device here and
+		 * is validated below once the supported pages are known.
+		 */
 		memset(buffer, '\0', MAXBUFSIZE);
-		if (0 == sg_ll_inquiry(device_fd, 0, 0, 0, buffer, 64, 1, 0)) {
+		stdLen = fetchPage(device_fd, openMe, pages, replay, buffer, 0, 0, 0);
+		peripheral = buffer[0];
+		if (0 < stdLen) {
 			/* Stuff the returned buffer into a string for easier parsing */
 			int j = 8;
 			while (j < 40) {
@@ -1495,31 +2015,29 @@ int nvme_read_mi_vpd(int device_fd, void *buf)
 		 * evpd set
 		 */
 
+		memset(pageSupported, 0, sizeof(pageSupported));
 		memset(buffer, '\0', MAXBUFSIZE);
-		len = doSGQuery(device_fd, buffer, MAXBUFSIZE, 1, 0, 0);
+		len = fetchPage(device_fd, openMe, pages, replay, buffer, 0, 1, 0);
 		if (len > 0) {
-			for (int i = 4; i < len; ++i) {
-				int byteValue = (int)buffer[i];
-				byteValues.push_back(byteValue);
-			}
+			for (int i = 4; i < len; ++i)
+				pageSupported[(unsigned char)buffer[i]] = true;
 		}
 
 		/* SG Utils Inquiry
 		 * Can device be quieried?  Initial Query
 		 */
-		memset(buffer, '\0', MAXBUFSIZE);
-		len = doSGQuery(device_fd, buffer, MAXBUFSIZE, 0, 0, 0);
-		if (0 < len) {
+		if (0 < stdLen) {
 			/*
 			 * Validate data: if the inquiry data is short or it tells us
 			 * that the "target is not capable of supporting a device on
 			 * this logical unit, then don't bother proceeding.
 			 */
-			if ((len < 32) || (0x7F == buffer[0])) {
+			if ((stdLen < 32) || (0x7F == peripheral)) {
 				return -SG_DATA_INVALID;
 			}
 
-			subtype = buffer[0] & 0x1F;
+			subtype = peripheral & 0x1F;
+			len = stdLen;
 
 			/* Lookup this subtype in the desc table */
 			i = 0;
@@ -1552,6 +2070,35 @@ int nvme_read_mi_vpd(int device_fd, void *buf)
 
 				if( pageCode == "DIAG" )
 				{
+					/* Replaying: the slot found when last queried */
+					if (!live) {
+						const InquiryPage *slot = pages == NULL ? NULL :
+							InquiryCache::findPage(*pages,
+								RAW_SCSI_SLOT, 0, 0, 0);
+
+						if (slot != NULL)
+							fillMe->mSecondLocation.setValue(
+								slot->data, 60,
+								__FILE__, __LINE__);
+						continue;
+					}
+
+					/*
+					 * Once SES has been seen to number this disk's
+					 * enclosure the way page 2 does, take the slot
+					 * from it rather than from the disk.
+					 */
+					if (PAGE_SUPPORTED(pageSupported, 0x02)) {
+						string slot = getEnclosureSlot(fillMe);
+
+						if (!slot.empty()) {
+							fillMe->mSecondLocation.setValue(slot,
+									60, __FILE__, __LINE__);
+							recordSlot(pages, slot);
+							continue;
+						}
+					}
+
 					/*
 					 * Special case to retrieve Physical locations using
 					 * receive diagnostics call.
@@ -1565,9 +2112,10 @@ int nvme_read_mi_vpd(int device_fd, void *buf)
 						evpd = 0;
 					else evpd = 1;
 
-					if (std::find(byteValues.begin(), byteValues.end(), pageCodeInt) != byteValues.end())
-						len = doSGQuery( device_fd, buffer, MAXBUFSIZE, evpd,
-								 pageCodeInt, RECEIVE_DIAGNOSTIC );
+					if (PAGE_SUPPORTED(pageSupported, pageCodeInt))
+						len = fetchPage(device_fd, openMe, pages, replay,
+								buffer, 0, evpd,
+								pageCodeInt, RECEIVE_DIAGNOSTIC);
 				}
 				else
 				{
@@ -1585,10 +2133,16 @@ int nvme_read_mi_vpd(int device_fd, void *buf)
 					// Query this page
 					memset(buffer, '\0', MAXBUFSIZE);
 					//					coutd << "Attempting query, evpd = " << evpd << ", pageCodeInt = " << pageCodeInt <<endl;
-					if (std::find(byteValues.begin(), byteValues.end(), pageCodeInt) != byteValues.end())
-						len = doSGQuery(device_fd, buffer, MAXBUFSIZE, evpd, pageCodeInt, 0);
+					if (PAGE_SUPPORTED(pageSupported, pageCodeInt))
+						len = fetchPage(device_fd, openMe, pages, replay,
+								buffer, 0, evpd,
+								pageCodeInt);
 				}
 
+				/* Replaying: skip what wasn't stored */
+				if (len == -UNABLE_TO_OPEN_FILE && !live)
+					continue;
+
 				if (len < 0) {
 					//Query resulted in bad result
 					return len;
@@ -1608,9 +2162,17 @@ int nvme_read_mi_vpd(int device_fd, void *buf)
 				 printf("\n");*/
 
 				//Interpret only the pages that are supported
-				if (std::find(byteValues.begin(), byteValues.end(), pageCodeInt) != byteValues.end())
+				if (PAGE_SUPPORTED(pageSupported, pageCodeInt))
 					interpretPage(fillMe, buffer, len, pageCodeInt, &pageFormat,
 						      subtype, &subtypeDS);
+
+				if (pageCode == "DIAG" &&
+				    PAGE_SUPPORTED(pageSupported, pageCodeInt)) {
+					checkEnclosureSlot(fillMe,
+						fillMe->mSecondLocation.getValue());
+					recordSlot(pages,
+						fillMe->mSecondLocation.getValue());
+				}
 			}
 		}
 
@@ -1761,14 +2323,172 @@ int nvme_read_mi_vpd(int device_fd, void *buf)
 		return;
 	}
 
+	/**
+	 * @brief: Map every device the SES driver placed in an enclosure slot
+	 *	to that slot number.  The kernel queries each enclosure once and
+	 *	publishes the result under /sys/class/enclosure/<enclosure>/
+	 *	<component>/{device,slot}.
+	 */
+	void SysFSTreeCollector::findEnclosureSlots( )
+	{
+		string base = "/sys/class/enclosure";
+		vector<string> enclosures, components;
+		string enclosure, device, slot;
+
+		mEnclosuresScanned = true;
+
+		fsw.fs_getDirContents(base, '*', enclosures);
+		for (unsigned int i = 0; i < enclosures.size(); i++) {
+			enclosure = resolvedPath(base + "/" + enclosures[i]);
+			if (enclosure.empty())
+				continue;
+
+			components.clear();
+			fsw.fs_getDirContents(enclosure, 'd', components);
+			for (unsigned int j = 0; j < components.size(); j++) {
+				string comp = enclosure + "/" + components[j];
+				EnclosureSlot where;
+
+				device = resolvedPath(comp + "/device");
+				slot = getAttrValue(comp, "slot");
+				if (device.empty() || slot.empty())
+					continue;
+
+				ostringstream os;
+				os << atoi(slot.c_str());
+				where.enclosure = enclosure;
+				where.slot = os.str();
+				mEnclosureSlots[device] = where;
+			}
+		}
+	}
+
+	/**
+	 * @brief: Slot of a SCSI device within its enclosure, as reported by
+	 *	the SES driver.  The slot in diagnostic page 2 is vendor
+	 *	specific, so SES is only trusted for an enclosure after
+	 *	SES_SLOT_CHECKS of its disks reported the same slot in page 2,
+	 *	and never after one didn't.
+	 * @return slot number, or an empty string if it isn't known or
+	 *	trusted
+	 */
+	string SysFSTreeCollector::getEnclosureSlot( Component *fillMe )
+	{
+		map<string, EnclosureSlot>::const_iterator i;
+		map<string, int>::const_iterator checks;
+
+		if (!mEnclosuresScanned)
+			findEnclosureSlots();
+
+		if (mEnclosureSlots.empty())
+			return "";
+
+		i = mEnclosureSlots.find(resolvedPath(fillMe->sysFsNode.getValue()));
+		if (i == mEnclosureSlots.end())
+			return "";
+
+		checks = mEnclosureChecks.find(i->second.enclosure);
+		if (checks == mEnclosureChecks.end() ||
+		    checks->second < SES_SLOT_CHECKS)
+			return "";
+		return i->second.slot;
+	}
+
+	/**
+	 * @brief: Compare the slot a disk reported in diagnostic page 2 with
+	 *	the one SES gives it, see getEnclosureSlot.
+	 */
+	void SysFSTreeCollector::checkEnclosureSlot( Component *fillMe,
+						     const string& diagSlot )
+	{
+		map<string, EnclosureSlot>::const_iterator i;
+
+		if (!mEnclosuresScanned)
+			findEnclosureSlots();
+
+		i = mEnclosureSlots.find(resolvedPath(fillMe->sysFsNode.getValue()));
+		if (i == mEnclosureSlots.end())
+			return;
+
+		int& checks = mEnclosureChecks[i->second.enclosure];
+		if (checks < 0)
+			return;
+
+		if (diagSlot == i->second.slot)
+			checks++;
+		else
+			checks = -1;
+	}
+
+	/**
+	 * @brief: Find the SCSI hosts driven by ipr, once per run, and
+	 *	locate iprconfig if there are any.  Leaves mIprHosts empty when
+	 *	there is nothing iprconfig could report on.
+	 */
+	void SysFSTreeCollector::findIPRHosts( )
+	{
+		string base = "/sys/class/scsi_host";
+		vector<string> hosts;
+
+		mIprScanned = true;
+
+		fsw.fs_getDirContents(base, '*', hosts);
+		for (unsigned int i = 0; i < hosts.size(); i++)
+			if (trimAttr(getAttrValue(base + "/" + hosts[i],
+						  "proc_name")) == "ipr")
+				mIprHosts.insert(hosts[i]);
+
+		if (mIprHosts.empty())
+			return;
+
+		mIprconfigPath = FSWalk::get_cmd_path("iprconfig");
+		if (mIprconfigPath.empty())
+			mIprHosts.clear();
+	}
+
+	/* Name of the SCSI host (hostN) a device sits under, from its sysfs path */
+	static string scsiHostName( const string& sysPath )
+	{
+		string::size_type beg = 0, end;
+		string elem, host;
+
+		while (beg < sysPath.length()) {
+			end = sysPath.find('/', beg);
+			if (end == string::npos)
+				end = sysPath.length();
+
+			elem = sysPath.substr(beg, end - beg);
+			if (elem.length() > 4 && elem.compare(0, 4, "host") == 0 &&
+			    elem.find_first_not_of("0123456789", 4) == string::npos)
+				host = elem;
+
+			beg = end + 1;
+		}
+
+		return host;
+	}
+
 	void SysFSTreeCollector::fillIPRData( Component *fillMe )
 	{
-		string path = findGenericSCSIDevPath( fillMe );
+		string path;
 		string sg, output;
 		char *devSg;
 		string cmd;
-		string cmd_path;
 
+		/* iprconfig talks to the adapter, nothing for it when reparsing */
+		if (mInquiryCache != NULL && mInquiryCache->reparse())
+			return;
+
+		/* Only devices behind an ipr adapter have anything to report */
+		if (!mIprScanned)
+			findIPRHosts();
+
+		if (mIprHosts.empty() ||
+		    mIprHosts.find(scsiHostName(fillMe->sysFsNode.getValue())) ==
+		    mIprHosts.end())
+			return;
+
+		path = findGenericSCSIDevPath( fillMe );
 		if (path == "")
 			return;
 
@@ -1780,11 +2500,7 @@ int nvme_read_mi_vpd(int device_fd, void *buf)
 		if (sg == "")
 			goto out;
 
-		cmd_path = FSWalk::get_cmd_path("iprconfig");
-		if (cmd_path.empty())
-			goto out;
-
-		cmd = cmd_path + " -c show-details " + sg;
+		cmd = mIprconfigPath + " -c show-details " + sg;
 		if (HelperFunctions::execCmd(cmd.c_str(), output))
 			goto out;
 
@@ -1793,6 +2509,54 @@ out:
 		free(devSg);
 	}
 
+	/**
+	 * @brief: Build a stable identity for a SCSI device from what the
+	 *	kernel already cached in sysfs, without issuing any command.
+	 *	The WWN (from the page 0x83 designators) is preferred, falling
+	 *	back to vendor, model and the page 0x80 serial number.  The
+	 *	revision is appended so a firmware update invalidates the entry.
+	 * @return the identity, or an empty string if the device has none
+	 */
+	string SysFSTreeCollector::getScsiIdentity( Component *fillMe )
+	{
+		string node = fillMe->sysFsNode.getValue();
+		string id, serial, pg80;
+
+		id = trimAttr(getAttrValue(node, "wwid"));
+		if (id.empty()) {
+			pg80 = getBinaryData(node + "/vpd_pg80");
+			if (pg80.length() > 4)
+				serial = trimAttr(pg80.substr(4,
+						(unsigned char) pg80[3]));
+			if (serial.empty())
+				return "";
+
+			id = trimAttr(getAttrValue(node, "vendor")) + ":" +
+				trimAttr(getAttrValue(node, "model")) + ":" +
+				serial;
+		}
+
+		return id + " rev " + trimAttr(getAttrValue(node, "rev"));
+	}
+
+	/**
+	 * @brief: Identity of an NVMe controller for the inquiry cache, from
+	 *	the model, serial number and firmware revision in sysfs.
+	 * @arg ctrlDir: sysfs directory of the controller (.../nvme/nvmeN)
+	 * @return the identity, or an empty string if there is no serial
+	 */
+	string SysFSTreeCollector::getNvmeIdentity( const string& ctrlDir )
+	{
+		string serial = trimAttr(getAttrValue(ctrlDir, "serial"));
+
+		if (serial.empty())
+			return "";
+
+		return "nvme " + trimAttr(getAttrValue(ctrlDir, "model")) +
+			":" + serial + " rev " +
+			trimAttr(getAttrValue(ctrlDir, "firmware_rev"));
+	}
+
 	/********************************************************************
 	 *
 	 * @brief: Main function for querying a device for SCSI info.
@@ -1811,15 +2575,76 @@ out:
 
 		/* Need major:minor codes to query device */
 		if (!get_mm_scsi(fillMe)) {
+			map<string, vector<InquiryPage> >::iterator lun;
+			vector<InquiryPage> pages, persist;
+			string identity;
+			bool cached = false;
+
+			identity = getScsiIdentity(fillMe);
 
-			// Open Device for reading
-			device_fd = device_open(fillMe);
-			if (device_fd < 0)
+			/*
+			 * Another path to a LUN we already queried (dm-multipath):
+			 * reuse its responses without touching the device.  The
+			 * location code is still built from this path's own address.
+			 */
+			if (!identity.empty()) {
+				lun = mLunPages.find(identity);
+				if (lun != mLunPages.end()) {
+					device_fd = -1;
+					collectVpd(fillMe, device_fd, limitSCSISize,
+						   &lun->second, true);
+					fillIPRData( fillMe );
+					return;
+				}
+			}
+
+			/* Same device as last time: replay its inquiry pages */
+			if (mInquiryCache != NULL)
+				cached = mInquiryCache->lookup(identity, pages);
+
+			/* Reparsing: decode what was stored, never open the device */
+			if (mInquiryCache != NULL && mInquiryCache->reparse()) {
+				device_fd = -1;
+				if (cached)
+					collectVpd(fillMe, device_fd, limitSCSISize,
+						   &pages, true);
 				return;
+			}
+
+			/*
+			 * Open Device for reading.  When its pages are cached the
+			 * device is only opened if the template asks for one that
+			 * isn't.
+			 */
+			device_fd = -1;
+			if (!cached) {
+				device_fd = device_open(fillMe);
+				if (device_fd < 0)
+					return;
+			}
+
+			if (collectVpd(fillMe, device_fd, limitSCSISize, &pages,
+				       cached, true) == 0) {
+				if (!identity.empty())
+					mLunPages[identity] = pages;
 
-			collectVpd(fillMe, device_fd, limitSCSISize);
+				/*
+				 * RECEIVE DIAGNOSTIC results describe the slot the
+				 * device sits in, so they are only kept for this run;
+				 * the slot taken from them is kept for --reparse.
+				 * Replayed entries are written back too, since pages
+				 * new templates asked for may have been added.
+				 */
+				if (mInquiryCache != NULL) {
+					for (unsigned int i = 0; i < pages.size(); i++)
+						if (pages[i].cmd != RECEIVE_DIAGNOSTIC)
+							persist.push_back(pages[i]);
+					mInquiryCache->update(identity, persist);
+				}
+			}
 
-			close(device_fd);
+			if (device_fd >= 0)
+				close(device_fd);
 		}
 
 		fillIPRData( fillMe );
@@ -30,6 +30,7 @@
 #define _XOPEN_SOURCE 500 // For pread
 
 #include <sysfstreecollector.hpp>
+#include <spyrevpd.hpp>
 
 #include <libvpd-2/helper_functions.hpp>
 #include <libvpd-2/debug.hpp>
@@ -39,6 +40,7 @@
 
 #include <linux/vfio.h>
 #include <sys/mman.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/utsname.h>
@@ -46,6 +48,7 @@
 #include <sys/param.h>
 #include <sys/sysmacros.h>
 #include <dirent.h>
+#include <endian.h>
 #include <libgen.h>		// for basename()
 #include <stdint.h>
 #include <unistd.h>
@@ -57,6 +60,7 @@
 #include <linux/sockios.h>
 #include <linux/ethtool.h>
 #include <linux/hdreg.h>
+#include <linux/pci_regs.h>
 #include <net/if_arp.h>
 #include <net/if.h>
 
@@ -70,8 +74,6 @@
 #define ECID1 0x080588
 #define MNIMI_DATA 0x0802C0
 
-std::map<std::string, bool> g_deviceAccessible;
-
 extern int errno;
 
 using namespace std;
@@ -83,17 +85,30 @@ namespace lsvpd
 {
 	void findDevicePaths(vector<Component*>& devs);
 
-	SysFSTreeCollector::SysFSTreeCollector( bool limitSCSISize = false ) :
-		mLimitSCSISize( limitSCSISize )
+	SysFSTreeCollector::SysFSTreeCollector( bool limitSCSISize = false,
+						InquiryCacheMode cacheMode = CACHE_REUSE ) :
+		mLimitSCSISize( limitSCSISize ), mIprScanned( false ),
+		mEnclosuresScanned( false ), mNvmePrefetched( false ),
+		mSpyrePrefetched( false ), mPciOverridesLoaded( false )
 	{
 		ifstream id;
+		ostringstream stamp;
 		mPciTable = NULL;
 		mUsbTable = NULL;
 
+		/*
+		 * Cached inquiry pages are only valid for the template set and
+		 * inquiry size they were collected with.
+		 */
+		stamp << InquiryCache::fileStamp( SCSI_TEMPLATES_FILE )
+			<< ( limitSCSISize ? " limited" : " full" );
+		mInquiryCache = new InquiryCache( SCSI_INQUIRY_CACHE_FILE,
+						  stamp.str( ), cacheMode );
+
 		id.open( DeviceLookup::getPciIds( ).c_str( ), ios::in );
 		if( id )
 		{
-			mPciTable = new DeviceLookup( id );
+			mPciTable = new DeviceLookup( DeviceLookup::getPciIds( ), id );
 			id.close( );
 		}
 		else
@@ -107,7 +122,7 @@ namespace lsvpd
 		id.open( DeviceLookup::getUsbIds( ).c_str( ), ios::in );
 		if( id )
 		{
-			mUsbTable = new DeviceLookup( id );
+			mUsbTable = new DeviceLookup( DeviceLookup::getUsbIds( ), id );
 			id.close( );
 		}
 		else
@@ -126,6 +141,70 @@ namespace lsvpd
 
 		if( mUsbTable != NULL )
 			delete mUsbTable;
+
+		if( mInquiryCache != NULL )
+		{
+			mInquiryCache->save( );
+			delete mInquiryCache;
+		}
+	}
+
+	/**
+	 * Fetch raw data recorded for identity by an earlier run.  Only
+	 * used when reparsing; otherwise devices are always read.
+	 * @return true if data and ret hold the recorded response
+	 */
+	bool SysFSTreeCollector::storedRawData( const string& identity, int kind,
+						string& data, int& ret )
+	{
+		vector<InquiryPage> pages;
+		const InquiryPage *page;
+
+		if( mInquiryCache == NULL )
+			return false;
+
+		if( !mInquiryCache->reparse( ) )
+			return false;
+
+		if( !mInquiryCache->lookup( identity, pages ) )
+			return false;
+
+		page = InquiryCache::findPage( pages, kind, 0, 0, 0 );
+		if( page == NULL )
+			return false;
+
+		data = page->data;
+		ret = page->ret;
+		return true;
+	}
+
+	/**
+	 * Record raw data read for identity, replacing any earlier record of
+	 * the same kind, so a later reparse can use it.
+	 */
+	void SysFSTreeCollector::storeRawData( const string& identity, int kind,
+					       const string& data, int ret )
+	{
+		vector<InquiryPage> pages, keep;
+		InquiryPage page;
+
+		if( mInquiryCache == NULL || identity.empty( ) )
+			return;
+
+		mInquiryCache->lookup( identity, pages );
+		for( unsigned int i = 0; i < pages.size( ); i++ )
+			if( pages[ i ].cmd != kind )
+				keep.push_back( pages[ i ] );
+
+		page.cmd = kind;
+		page.evpd = 0;
+		page.pageCode = 0;
+		page.alloc = 0;
+		page.ret = ret;
+		page.data = data;
+		keep.push_back( page );
+
+		mInquiryCache->update( identity, keep );
 	}
 
 	void SysFSTreeCollector::scsiGetHTBL(Component *fillMe)
@@ -198,10 +277,11 @@ namespace lsvpd
 		{
 			fillUSBDev( fillMe, fillMe->sysFsLinkTarget.getValue() );
 			/*
-			 * Since usb storage devices are treated as SCSI devices,
-			 * we can get useful information from sg_utils
+			 * No SCSI probing here: usb storage shows up as a scsi bus
+			 * device under the interface's scsi_host and is queried with
+			 * sg_utils from there.  Hubs, HID and other interfaces have
+			 * nothing to answer an inquiry with.
 			 */
-			fillSCSIComponent(fillMe, mLimitSCSISize);
 			usbGetHTBL(fillMe);  /*Get identifiers for device */
 		}
 		else if( bus == "ide" )
@@ -1320,99 +1400,161 @@ esc_subsystem_info:
 		}
 	}
 
+	/**
+	 * Read the VPD of a PCI function one resource at a time, up to the
+	 * end tag.  Each read of the sysfs vpd file is a series of slow VPD
+	 * cycles on the adapter, so the unused rest of the 32K window is
+	 * never touched.
+	 */
+	static string readPciVpd( const string& path )
+	{
+		unsigned char hdr[ 3 ];
+		size_t hlen, dlen;
+		ssize_t got;
+		off_t off = 0;
+		string vpd;
+		int fd;
+
+		fd = open( path.c_str( ), O_RDONLY );
+		if( fd < 0 )
+			return vpd;
+
+		while( off < PCI_VPD_MAX_LEN )
+		{
+			if( pread( fd, hdr, 1, off ) != 1 )
+				break;
+
+			if( hdr[ 0 ] == PCI_VPD_TAG_ID_STRING ||
+			    hdr[ 0 ] == PCI_VPD_TAG_RO || hdr[ 0 ] == PCI_VPD_TAG_RW )
+			{
+				if( pread( fd, hdr + 1, 2, off + 1 ) != 2 )
+					break;
+				hlen = 3;
+				dlen = hdr[ 1 ] | hdr[ 2 ] << 8;
+			}
+			else if( ( hdr[ 0 ] & 0xf8 ) == PCI_VPD_TAG_END )
+			{
+				hlen = 1;
+				dlen = hdr[ 0 ] & 0x07;
+			}
+			else
+				/* Unprogrammed or not VPD at all */
+				break;
+
+			if( off + hlen + dlen > PCI_VPD_MAX_LEN )
+				break;
+
+			vpd.append( (char *)hdr, hlen );
+			if( dlen > 0 )
+			{
+				vpd.resize( off + hlen + dlen );
+				got = pread( fd, &vpd[ off + hlen ], dlen, off + hlen );
+				if( got != (ssize_t)dlen )
+				{
+					vpd.resize( off );
+					break;
+				}
+			}
+			off += hlen + dlen;
+
+			if( ( hdr[ 0 ] & 0xf8 ) == PCI_VPD_TAG_END )
+				break;
+		}
+
+		close( fd );
+		return vpd;
+	}
+
 	unsigned int SysFSTreeCollector::parsePciVPDBuffer( Component* fillMe,
 						    const char *buf, int size )
 	{
 		char key[ 3 ] = { '\0' };
 		/* Each VPD field will be at most 255 bytes long */
 		char val[ 256 ];
-		const char *end;
-		unsigned char length;
-		uint16_t len;
+		const unsigned char *start, *end, *res, *resEnd;
+		unsigned char tag, length;
+		unsigned int len;
 		string field;
 
 		/*
-		 * The format of the VPD Data is a series of sections, with
-		 * each section containing keyword followed by length as shown
-		 * below:
+		 * PCI VPD is a series of resources, each a tag and a length
+		 * followed by data:
 		 *
-		 *   _ section start here
-		 *  |
-		 *  v
-		 *  ----------------------------------------------------------
-		 * | Section ID(1) | len(2) | data(len) | section1 tag(1) |   |
 		 *  ----------------------------------------------------------
-		 * | len (1) | key(2) | record_len(1) | data(record_len) |    |
+		 * | 0x82 | len(2) | product name                             |
 		 *  ----------------------------------------------------------
-		 * | key(2) | ....... | section2 tag(1) | len(1) | data(len)| |
+		 * | 0x90 | len(2) | key(2) | len(1) | data | key(2) | ...    |
 		 *  ----------------------------------------------------------
-		 * |.....| sectionN tag (1) | len(1) | data(len) | end tag(1) |
+		 * | 0x91 | len(2) | key(2) | len(1) | data | key(2) | ...    |
 		 *  ----------------------------------------------------------
+		 * | 0x78 |
+		 *  ------
+		 *
+		 * Keywords are taken from the read-only (0x90) and read-write
+		 * (0x91) resources.  RV holds the checksum and RW the unused
+		 * writable space, neither is VPD.
 		 */
+		start = (const unsigned char *)buf;
+		end = start + size;
+		res = start;
 
-		if (*buf != 0x82)
-			return 0;
-
-		end = buf + size;
-
-		/* Increment buffer to point to offset 1 to read Product
-		 * Name length
-		 */
-		buf++;
-		if (buf >= end)
-			return 0;
-
-		/* Data length is 2 bytes (byte 1 LSB, byte 2 MSB) */
-		len = *buf | (buf[1] << 8);
-
-		/* Increment buffer to point to read Product Name */
-		buf += 2;
-		if (buf >= end)
-			return 0;
-
-		/* Increment buffer to point to VPD R Tag */
-		buf += len;
-		if (buf >= end)
-			return 0;
-
-		/* Increment buffer to point to VPD R Tag data length */
-		buf++;
-		if (buf >= end)
-			return 0;
-
-		/* Increment buffer to point to first VPD keyword */
-		/* Increment by 2 because data length is of size 2 bytes */
-		buf += 2;
-		if (buf >= end)
-			return 0;
-
-		while( buf < end && *buf != 0x78 && *buf != 0x79 )
+		while( res < end )
 		{
-			memset( key, '\0', 3 );
-			memset( val, '\0', 256 );
-
-			if( buf + 3 >= end )
+			tag = *res;
+			if( tag & 0x80 )
 			{
-				goto ERROR;
+				/* Large resource: 2 byte length, LSB first */
+				if( res + 3 > end )
+					goto ERROR;
+				len = res[ 1 ] | res[ 2 ] << 8;
+				res += 3;
+			}
+			else
+			{
+				len = tag & 0x07;
+				res++;
 			}
 
-			key[ 0 ] = buf[ 0 ];
-			key[ 1 ] = buf[ 1 ];
-			length = buf[ 2 ];
-			buf += 3;
+			if( res + len > end )
+				goto ERROR;
+			resEnd = res + len;
+
+			if( ( tag & 0xf8 ) == PCI_VPD_TAG_END )
+				return resEnd - start;
 
-			if( buf + length >= end )
+			if( tag != PCI_VPD_TAG_RO && tag != PCI_VPD_TAG_RW )
 			{
-				goto ERROR;
+				res = resEnd;
+				continue;
 			}
 
-			memcpy( val, buf, length );
-			buf += length;
+			while( res < resEnd )
+			{
+				if( res + 3 > resEnd )
+					goto ERROR;
+
+				key[ 0 ] = res[ 0 ];
+				key[ 1 ] = res[ 1 ];
+				length = res[ 2 ];
+				res += 3;
 
-			field = sanitizeVPDField(val, length);
-			setVPDField( fillMe, key, field, __FILE__, __LINE__ );
+				if( res + length > resEnd )
+					goto ERROR;
+
+				if( strcmp( key, "RV" ) != 0 &&
+				    strcmp( key, "RW" ) != 0 )
+				{
+					memset( val, '\0', 256 );
+					memcpy( val, res, length );
+					field = sanitizeVPDField( val, length );
+					setVPDField( fillMe, key, field, __FILE__,
+						     __LINE__ );
+				}
+				res += length;
+			}
 		}
 
+		/* No end tag, but every resource was complete */
 		return size;
 ERROR:
 		Logger logger;
@@ -1420,96 +1562,264 @@ ERROR:
 		return 0;
 	}
 
-	void SysFSTreeCollector::fillSpyreVpd(Component* fillMe)
+	/* @return true if the PCI function at sysDir is a Spyre card */
+	static bool isSpyreCard(const string& sysDir)
 	{
-		string path;
-		Logger l;
 		char device_id[16] = {0};
-		int container_fd = -1, group_fd = -1, device_fd = -1;
-		int iommu_type = -1;
-		char path_buf[256] = {0}, group_path[256] = {0};
-		char* group_name = nullptr;
-		ssize_t len = 0;
-		uint64_t eeprom_data = 0;
-		struct vfio_region_info reg = {0};
-		void* bar0_mem = nullptr;
-		unsigned char* bar0_ptr = nullptr;
-		ostringstream ss;
-		uint8_t eeprom_res_manu = 0;
-		uint8_t boot_version = 0;
-		string boot_version_str;
-		string partNumber;
-
-		/* Read device ID */
-		path = fillMe->getID() + "/device";
+		string path = sysDir + "/device";
 		ifstream device_stream(path.c_str());
+
 		if (!device_stream)
-			return;
+			return false;
 
 		device_stream.getline(device_id, sizeof(device_id));
-		device_stream.close();
+		return strcmp(device_id, "0x06a7") == 0 ||
+		       strcmp(device_id, "0x06a8") == 0;
+	}
 
-		/* Check if the device is Spyre (device ID 0x06a7 or 0x06a8) */
-		if (strcmp(device_id, "0x06a7") != 0 && strcmp(device_id, "0x06a8") != 0)
-			return;
+	/* Issue one MNIMI EEPROM read and return the data word */
+	static uint64_t readMnimi(unsigned char* bar0_ptr, uint64_t inst)
+	{
+		*((volatile uint64_t*)(bar0_ptr + MNIMI_INST)) = inst;
+		usleep(50000);
+		return *((volatile uint64_t*)(bar0_ptr + MNIMI_DATA));
+	}
 
-		l.log("Confirmed Spyre device " + fillMe->getID() + " with ID: " + string(device_id), LOG_INFO);
+	static string read11S(unsigned char* bar0_ptr)
+	{
+		string result;
+		char buffer[8];
 
-		/* Open VFIO container */
-		container_fd = open("/dev/vfio/vfio", O_RDWR);
-		if (container_fd < 0) {
-			l.log("Failed to open VFIO container /dev/vfio/vfio for " + fillMe->getID() +
-					", errno: " + to_string(errno) + " (" + strerror(errno) + ")", LOG_ERR);
-			return;
+		uint64_t eeprom11s_0 = readMnimi(bar0_ptr, 0xa101e001200b1467);
+		uint64_t eeprom11s_1 = readMnimi(bar0_ptr, 0xa101e801200b1467);
+		uint64_t eeprom11s_2 = readMnimi(bar0_ptr, 0xa101f001200b1467) & 0xFFFFFF0000000000;
+
+		uint64_t values[3] = {eeprom11s_0, eeprom11s_1, eeprom11s_2};
+
+		for (int val_idx = 0; val_idx < 3; val_idx++) {
+			for (int byte_idx = 0; byte_idx < 8; byte_idx++) {
+				buffer[byte_idx] = (values[val_idx] >> (56 - byte_idx * 8)) & 0xFF;
+			}
+			result.append(buffer, 8);
 		}
-		l.log("Successfully opened VFIO container for " + fillMe->getID(), LOG_DEBUG);
 
-		/* Check for IOMMU Support */
-		if (ioctl(container_fd, VFIO_CHECK_EXTENSION, VFIO_TYPE1_IOMMU) == 1) {
-			iommu_type = VFIO_TYPE1_IOMMU;
-			l.log("Using VFIO_TYPE1_IOMMU for " + fillMe->getID(), LOG_DEBUG);
-		} else if (ioctl(container_fd, VFIO_CHECK_EXTENSION, VFIO_SPAPR_TCE_IOMMU) == 1) {
-			iommu_type = VFIO_SPAPR_TCE_IOMMU;
-			l.log("Using VFIO_SPAPR_TCE_IOMMU for " + fillMe->getID(), LOG_DEBUG);
+		result.erase(remove(result.begin(), result.end(), '\0'), result.end());
+		return result;
+	}
+
+	/*
+	 * Map BAR0 of the VFIO device behind device_fd and read the EEPROM
+	 * words into res.  Nothing here logs, it runs on the prefetch threads.
+	 */
+	static void readSpyreEeprom(int device_fd, SpyreVpdData& res)
+	{
+		struct vfio_region_info reg = {0};
+		void* bar0_mem = nullptr;
+
+		reg.argsz = sizeof(reg);
+		reg.index = VFIO_PCI_BAR0_REGION_INDEX;
+		if (ioctl(device_fd, VFIO_DEVICE_GET_REGION_INFO, &reg) < 0) {
+			res.rc = -errno;
+			return;
 		}
-		else {
-			l.log("No supported IOMMU type found for " + fillMe->getID(), LOG_ERR);
-			close(container_fd);
+
+		bar0_mem = mmap(NULL, reg.size, PROT_READ | PROT_WRITE, MAP_SHARED, device_fd, reg.offset);
+		if (bar0_mem == MAP_FAILED) {
+			res.rc = -errno;
 			return;
 		}
 
-		/* Get IOMMU group */
-		snprintf(path_buf, sizeof(path_buf), "%s/iommu_group", fillMe->getID().c_str());
-		len = readlink(path_buf, group_path, sizeof(group_path) - 1);
-		if (len < 0) {
-			l.log("Failed to read IOMMU group symlink " + string(path_buf) + " for " + fillMe->getID() +
-					", errno: " + to_string(errno) + " (" + strerror(errno) + ")", LOG_ERR);
-			close(container_fd);
+		res.eeprom = readMnimi((unsigned char*)bar0_mem, 0xa101f801200b1467);
+		res.eeprom11s = read11S((unsigned char*)bar0_mem);
+		res.read = true;
+		res.rc = 0;
+
+		munmap(bar0_mem, reg.size);
+	}
+
+	/* Index handed out to the runBounded threads */
+	struct bounded_pool {
+		pthread_mutex_t lock;
+		unsigned int next;
+		unsigned int count;
+		void (*work)(unsigned int i, void *arg);
+		void *arg;
+	};
+
+	static void *bounded_pool_worker(void *arg)
+	{
+		struct bounded_pool *p = (struct bounded_pool *) arg;
+		unsigned int idx;
+
+		for (;;) {
+			pthread_mutex_lock(&p->lock);
+			idx = p->next++;
+			pthread_mutex_unlock(&p->lock);
+
+			if (idx >= p->count)
+				break;
+
+			p->work(idx, p->arg);
+		}
+
+		return NULL;
+	}
+
+	unsigned int runBounded(unsigned int count, unsigned int maxThreads,
+				void (*work)(unsigned int i, void *arg), void *arg)
+	{
+		struct bounded_pool p;
+		vector<pthread_t> threads(min(count, maxThreads));
+		unsigned int i, started = 0;
+
+		if (count == 0)
+			return 0;
+
+		p.next = 0;
+		p.count = count;
+		p.work = work;
+		p.arg = arg;
+		pthread_mutex_init(&p.lock, NULL);
+
+		for (i = 0; i < threads.size(); i++) {
+			if (pthread_create(&threads[started], NULL,
+					   bounded_pool_worker, &p) == 0)
+				started++;
+		}
+
+		/* No threads to be had: do the work in this one */
+		if (started == 0)
+			bounded_pool_worker(&p);
+
+		for (i = 0; i < started; i++)
+			pthread_join(threads[i], NULL);
+
+		pthread_mutex_destroy(&p.lock);
+		return max(started, 1u);
+	}
+
+	/* Cards read by the Spyre read-ahead threads */
+	struct spyre_prefetch_queue {
+		vector<int> fds;		/* VFIO device fd of each card */
+		vector<SpyreVpdData> results;	/* Same order as fds */
+	};
+
+	static void spyre_prefetch_one(unsigned int idx, void *arg)
+	{
+		struct spyre_prefetch_queue *q = (struct spyre_prefetch_queue *) arg;
+
+		if (q->fds[idx] >= 0)
+			readSpyreEeprom(q->fds[idx], q->results[idx]);
+	}
+
+	/**
+	 * @brief: Read the EEPROM of every Spyre card in the system at once,
+	 *	before the fill pass asks for them one at a time.  Each read is
+	 *	a handful of MNIMI commands with a 50ms wait after each, so the
+	 *	cards are read by a small pool of threads.  Device fds come from
+	 *	the shared VFIO session up front, in this thread; the results
+	 *	are only used by fillSpyreVpd, in component order.
+	 */
+	void SysFSTreeCollector::prefetchSpyreVpd( )
+	{
+		string base = "/sys/bus/pci/devices";
+		struct spyre_prefetch_queue q;
+		vector<string> funcs, paths;
+		unsigned int i, threads;
+		char buf[PATH_MAX];
+		int device_fd;
+		SpyreVpdData none;
+		Logger l;
+
+		mSpyrePrefetched = true;
+
+		/* Nothing is read from the devices when reparsing */
+		if (mInquiryCache != NULL && mInquiryCache->reparse())
 			return;
+
+		fsw.fs_getDirContents(base, '*', funcs);
+		none.read = false;
+		none.eeprom = 0;
+		for (i = 0; i < funcs.size(); i++) {
+			if (realpath((base + "/" + funcs[i]).c_str(), buf) == NULL ||
+			    !isSpyreCard(buf))
+				continue;
+
+			none.groupOpened = true;
+			device_fd = mVfio.getDeviceFd(buf, none.groupOpened);
+			none.rc = min(device_fd, 0);
+			paths.push_back(buf);
+			q.fds.push_back(device_fd);
+			q.results.push_back(none);
 		}
 
-		group_path[len] = '\0';
-		group_name = strrchr(group_path, '/');
-		if (!group_name) {
-			l.log("Failed to extract group name from path: " + string(group_path) + " for " + fillMe->getID(), LOG_ERR);
-			close(container_fd);
+		if (paths.empty())
 			return;
+
+		threads = runBounded(paths.size(), SPYRE_PREFETCH_THREADS,
+				     spyre_prefetch_one, &q);
+
+		for (i = 0; i < paths.size(); i++) {
+			if (q.fds[i] >= 0)
+				close(q.fds[i]);
+			mSpyreVpd[paths[i]] = q.results[i];
 		}
-		group_name++;
 
-		l.log("Found IOMMU group: " + string(group_name) + " for " + fillMe->getID(), LOG_DEBUG);
+		l.log("Read the EEPROM of " + to_string(paths.size()) + " Spyre cards with " +
+				to_string(threads) + " threads", LOG_DEBUG);
+	}
 
-		/* Open the VFIO Group */
-		snprintf(path_buf, sizeof(path_buf), "/dev/vfio/%s", group_name);
-		group_fd = open(path_buf, O_RDWR);
+	void SysFSTreeCollector::fillSpyreVpd(Component* fillMe)
+	{
+		map<string, SpyreVpdData>::iterator it;
+		Logger l;
+		string source;
+		uint8_t eeprom_res_manu = 0;
+		uint8_t boot_version = 0;
+		string partNumber;
+		int device_fd;
+
+		if (!isSpyreCard(fillMe->getID()))
+			return;
 
-		g_deviceAccessible[fillMe->getID()] = true;
-		if (group_fd < 0) {
+		l.log("Confirmed Spyre device " + fillMe->getID(), LOG_INFO);
 
-			Logger l;
-			l.log("Failed to open VFIO group " + string(path_buf) + " for " + fillMe->getID(), LOG_ERR);
-			g_deviceAccessible[fillMe->getID()] = false;
+		if (!mSpyrePrefetched)
+			prefetchSpyreVpd();
 
+		/*
+		 * Not seen by the prefetch scan: read it on its own.  When
+		 * reparsing, nothing is, and the stored values are used as for
+		 * a card that is in use.
+		 */
+		it = mSpyreVpd.find(fillMe->getID());
+		if (it == mSpyreVpd.end()) {
+			SpyreVpdData res;
+
+			res.groupOpened = false;
+			res.read = false;
+			res.rc = 0;
+			res.eeprom = 0;
+			if (mInquiryCache == NULL || !mInquiryCache->reparse()) {
+				res.groupOpened = true;
+				device_fd = mVfio.getDeviceFd(fillMe->getID(),
+							      res.groupOpened);
+				res.rc = min(device_fd, 0);
+				if (device_fd >= 0) {
+					readSpyreEeprom(device_fd, res);
+					close(device_fd);
+				}
+			}
+			it = mSpyreVpd.insert(make_pair(fillMe->getID(), res)).first;
+		}
+		const SpyreVpdData& res = it->second;
+
+		/*
+		 * Where this card's VPD came from is kept in the component itself,
+		 * so it is stored in the database with it.
+		 */
+		if (!res.groupOpened) {
+			source = SPYRE_VPD_NONE;
 			if (spyreDb != nullptr) {
 				l.log("Attempting to use cached data from spyreDb for " + fillMe->getID(), LOG_INFO);
 
@@ -1545,100 +1855,46 @@ ERROR:
 						fillMe->mFirmwareLevel.setValue(spyreComp->mFirmwareLevel.getValue(), 80, __FILE__, __LINE__);
 					}
 
-				delete spyreComp;
+					/*
+					 * Only call the copy cached when the stored row had
+					 * VPD of its own; rows written before the source was
+					 * recorded count as having it if they carry a serial
+					 * or part number.
+					 */
+					string stored;
+					vector<DataItem*>::const_iterator d;
+					for (d = spyreComp->getDeviceSpecific().begin();
+					     d != spyreComp->getDeviceSpecific().end(); ++d) {
+						if ((*d)->getAC() == SPYRE_VPD_SOURCE) {
+							stored = (*d)->getValue();
+							break;
+						}
+					}
+					if (stored == SPYRE_VPD_LIVE || stored == SPYRE_VPD_CACHED ||
+					    (stored.empty() &&
+					     (!spyreComp->mSerialNumber.dataValue.empty() ||
+					      !spyreComp->mPartNumber.dataValue.empty())))
+						source = SPYRE_VPD_CACHED;
+
+					delete spyreComp;
 				l.log("Successfully populated component data from cache for " + fillMe->getID(), LOG_INFO);
 				} else {
 					l.log("No cached component data found in spyreDb for " + fillMe->getID(), LOG_WARNING);
 				}
 			}
-
-			close(group_fd);
-			close(container_fd);
-			return;
-		}
-
-		/* Check group status */
-		struct vfio_group_status group_status = {.argsz = sizeof(group_status)};
-		if (ioctl(group_fd, VFIO_GROUP_GET_STATUS, &group_status) < 0 ||
-				!(group_status.flags & VFIO_GROUP_FLAGS_VIABLE)) {
-			l.log("Failed to get VFIO group status for " + fillMe->getID() +
-					", errno: " + to_string(errno) + " (" + strerror(errno) + ")", LOG_ERR);
-			close(group_fd);
-			close(container_fd);
-			return;
-		}
-
-		/* Add group to container */
-		if (ioctl(group_fd, VFIO_GROUP_SET_CONTAINER, &container_fd) < 0) {
-			l.log("Failed to add VFIO group to container for " + fillMe->getID() +
-					", errno: " + to_string(errno) + " (" + strerror(errno) + ")", LOG_ERR);
-			close(group_fd);
-			close(container_fd);
-			return;
-		}
-		l.log("Successfully added VFIO group to container for " + fillMe->getID(), LOG_DEBUG);
-
-		/* Set IOMMU type */
-		if (iommu_type != -1 && ioctl(container_fd, VFIO_SET_IOMMU, iommu_type) < 0) {
-			l.log("Failed to set IOMMU type " + to_string(iommu_type) + " for " + fillMe->getID() +
-					", errno: " + to_string(errno) + " (" + strerror(errno) + ")", LOG_ERR);
-			close(group_fd);
-			close(container_fd);
-			return;
-		}
-
-		l.log("Successfully set IOMMU type for " + fillMe->getID(), LOG_DEBUG);
-
-		device_fd = ioctl(group_fd, VFIO_GROUP_GET_DEVICE_FD,
-				fillMe->getID().substr(fillMe->getID().rfind("/") + 1).c_str());
-
-		if (device_fd < 0) {
-			l.log("Failed to get device FD for " + fillMe->getID() +
-					", errno: " + to_string(errno) + " (" + strerror(errno) + ")", LOG_ERR);
-			close(group_fd);
-			close(container_fd);
-			return;
-		}
-
-		l.log("Successfully obtained device FD for " + fillMe->getID(), LOG_DEBUG);
-
-		/* Configure BAR0 region info */
-		reg.argsz = sizeof(reg);
-		reg.index = VFIO_PCI_BAR0_REGION_INDEX;
-
-		/* Get BAR0 Info */
-		if (ioctl(device_fd, VFIO_DEVICE_GET_REGION_INFO, &reg) < 0) {
-			l.log("Failed to get BAR0 region info for " + fillMe->getID() +
-					", errno: " + to_string(errno) + " (" + strerror(errno) + ")", LOG_ERR);
-			close(device_fd);
-			close(group_fd);
-			close(container_fd);
+			fillMe->addDeviceSpecific(SPYRE_VPD_SOURCE, "VPD Source", source, 100);
 			return;
 		}
 
-		/* Map BAR0 */
-		bar0_mem = mmap(NULL, reg.size, PROT_READ | PROT_WRITE, MAP_SHARED, device_fd, reg.offset);
-		if (bar0_mem == MAP_FAILED) {
-			l.log("Failed to map BAR0 memory for " + fillMe->getID() +
-					", errno: " + to_string(errno) + " (" + strerror(errno) + ")", LOG_ERR);
-			close(device_fd);
-			close(group_fd);
-			close(container_fd);
+		if (!res.read) {
+			l.log("Failed to read the EEPROM of Spyre card " + fillMe->getID() +
+					", errno: " + to_string(-res.rc) + " (" + strerror(-res.rc) + ")", LOG_ERR);
+			fillMe->addDeviceSpecific(SPYRE_VPD_SOURCE, "VPD Source", SPYRE_VPD_NONE, 100);
 			return;
 		}
 
-		l.log("Successfully mapped BAR0 memory for " + fillMe->getID(), LOG_DEBUG);
-
-		/* Read data from mapped memory */
-		bar0_ptr = (unsigned char*)bar0_mem;
-
-		*((uint64_t*)(bar0_ptr + MNIMI_INST)) = 0xa101f801200b1467;
-		usleep(50000);
-
-		eeprom_data = *((uint64_t*)(bar0_ptr + MNIMI_DATA));
-
 		/* Set Manufacturer based on EEPROM data */
-		eeprom_res_manu = eeprom_data & 0xFF;
+		eeprom_res_manu = res.eeprom & 0xFF;
 		if (eeprom_res_manu == 0xff || eeprom_res_manu == 0x0) {
 			fillMe->mManufacturer.setValue("Samsung", 80, __FILE__, __LINE__);
 		} else if (eeprom_res_manu == 0x1) {
@@ -1646,10 +1902,10 @@ ERROR:
 		}
 
 		/* Set Firmware Level */
-		boot_version = (eeprom_data >> 56) & 0xFF;
+		boot_version = (res.eeprom >> 56) & 0xFF;
 		fillMe->mFirmwareLevel.setValue(to_string(boot_version), 80, __FILE__, __LINE__);
 
-		string eeprom11s_sn = read11S(bar0_ptr);
+		const string& eeprom11s_sn = res.eeprom11s;
 		if (eeprom11s_sn.length() >= 7) {
 			partNumber = eeprom11s_sn.substr(0, 7);
 			fillMe->mPartNumber.setValue(partNumber, 100, __FILE__, __LINE__);
@@ -1657,53 +1913,11 @@ ERROR:
 
 		fillMe->mEngChangeLevel.setValue(eeprom11s_sn.substr(10, 1), 100, __FILE__, __LINE__);
 		fillMe->mSerialNumber.setValue(eeprom11s_sn.substr(7), 100, __FILE__, __LINE__);
-
-                /* Clean up memory mapping */
-                if (munmap(bar0_mem, reg.size) < 0) {
-			l.log("Warning: Failed to unmap BAR0 memory for " + fillMe->getID() +
-					", errno: " + to_string(errno) + " (" + strerror(errno) + ")", LOG_WARNING);
-		} else {
-			l.log("Successfully unmapped BAR0 memory for " + fillMe->getID(), LOG_DEBUG);
-		}
-
-		/* Clean up file descriptors */
-		close(device_fd);
-		close(group_fd);
-		close(container_fd);
+		fillMe->addDeviceSpecific(SPYRE_VPD_SOURCE, "VPD Source", SPYRE_VPD_LIVE, 100);
 
 		l.log("Successfully completed fillSpyreVpd for " + fillMe->getID(), LOG_INFO);
 	}
 
-	string SysFSTreeCollector::read11S(unsigned char* bar0_ptr)
-	{
-		string result;
-		char buffer[8];
-
-		*((uint64_t*)(bar0_ptr + MNIMI_INST)) = 0xa101e001200b1467;
-		usleep(50000);
-		uint64_t eeprom11s_0 = *((uint64_t*)(bar0_ptr + MNIMI_DATA));
-
-		*((uint64_t*)(bar0_ptr + MNIMI_INST)) = 0xa101e801200b1467;
-		usleep(50000);
-		uint64_t eeprom11s_1 = *((uint64_t*)(bar0_ptr + MNIMI_DATA));
-
-		*((uint64_t*)(bar0_ptr + MNIMI_INST)) = 0xa101f001200b1467;
-		usleep(50000);
-		uint64_t eeprom11s_2 = *((uint64_t*)(bar0_ptr + MNIMI_DATA)) & 0xFFFFFF0000000000;
-
-		uint64_t values[3] = {eeprom11s_0, eeprom11s_1, eeprom11s_2};
-
-		for (int val_idx = 0; val_idx < 3; val_idx++) {
-			for (int byte_idx = 0; byte_idx < 8; byte_idx++) {
-				buffer[byte_idx] = (values[val_idx] >> (56 - byte_idx * 8)) & 0xFF;
-			}
-			result.append(buffer, 8);
-		}
-
-		result.erase(remove(result.begin(), result.end(), '\0'), result.end());
-		return result;
-	}
-
 	void SysFSTreeCollector::fillPciNvmeVpd( Component* fillMe )
 	{
 		int device_fd;
@@ -1712,6 +1926,13 @@ ERROR:
 		path = fillMe->sysFsNode.getValue() + "/nvme";
 		if (stat(path.c_str(), &myDir) < 0)
 			return;
+
+		/* Reparsing: only what was stored, never open the device */
+		if (mInquiryCache != NULL && mInquiryCache->reparse()) {
+			collectNvmeVpd(fillMe, -1);
+			return;
+		}
+
 		device_fd = device_open(fillMe);
 		if (device_fd < 0)
 			return;
@@ -1720,88 +1941,293 @@ ERROR:
 		return;
 	}
 
+	/*
+	 * Pack the IDs of an adapter into the pci_overrides.conf table key.
+	 * Entries for any subsystem are kept in a table of their own, keyed
+	 * with both subsystem IDs 0.
+	 */
+	static uint64_t pciOverrideKey( int vendorId, int deviceId,
+					int subVendorId, int subDeviceId )
+	{
+		return (uint64_t)( vendorId & 0xffff ) << 48 |
+			(uint64_t)( deviceId & 0xffff ) << 32 |
+			(uint64_t)( subVendorId & 0xffff ) << 16 |
+			(uint64_t)( subDeviceId & 0xffff );
+	}
+
+	/* @return the 16 bit hex ID in str, or -1 */
+	static int pciOverrideID( const string& str )
+	{
+		char *end;
+		long id;
+
+		id = strtol( str.c_str( ), &end, 16 );
+		if( str.empty( ) || *end != '\0' || id < 0 || id > 0xffff )
+			return -1;
+		return id;
+	}
+
+	/**
+	 * pci_overrides.conf has one line per adapter:
+	 *
+	 *   "vendor", "device", "subvendor", "subdevice", "fields"
+	 *
+	 * IDs are hex, both subsystem IDs may be "*" to match any.  fields
+	 * is a ';' separated list of KEY=value, applied in order.  KEY@pref=
+	 * sets a preference other than PCI_OVERRIDE_PREF.  A later line for
+	 * the same IDs replaces an earlier one.  Lines starting with '#' are
+	 * comments.
+	 */
+	int SysFSTreeCollector::loadPciOverrides( const string& filename )
+	{
+		static const char *keys[] = { "PN", "EC", "FN", "FC", "CC", "CE",
+					      "DS", NULL };
+		string line, ids[ 4 ], fields, item;
+		int vendor, device, subVendor, subDevice, i;
+		bool anySub;
+		string::size_type pos, next, eq, at;
+		vector<PciOverrideField> entry;
+		PciOverrideField field;
+		ifstream fin( filename.c_str( ) );
+		Logger logger;
+
+		if( fin.fail( ) )
+		{
+			logger.log( "Error opening PCI override file : " + filename,
+				    LOG_NOTICE );
+			return -ENOENT;
+		}
+
+		while( getline( fin, line ) )
+		{
+			if( line.empty( ) || line[ 0 ] == '#' )
+				continue;
+
+			for( i = 0; i < 4; i++ )
+				HelperFunctions::parseString( line, i + 1, ids[ i ] );
+			HelperFunctions::parseString( line, 5, fields );
+
+			anySub = ids[ 2 ] == "*" && ids[ 3 ] == "*";
+			vendor = pciOverrideID( ids[ 0 ] );
+			device = pciOverrideID( ids[ 1 ] );
+			subVendor = anySub ? 0 : pciOverrideID( ids[ 2 ] );
+			subDevice = anySub ? 0 : pciOverrideID( ids[ 3 ] );
+			if( vendor < 0 || device < 0 || subVendor < 0 ||
+			    subDevice < 0 )
+			{
+				logger.log( "Bad IDs in " + filename + ": " + line,
+					    LOG_WARNING );
+				continue;
+			}
+
+			entry.clear( );
+			for( pos = 0; pos < fields.length( ); pos = next + 1 )
+			{
+				next = fields.find( ';', pos );
+				if( next == string::npos )
+					next = fields.length( );
+				item = fields.substr( pos, next - pos );
+
+				eq = item.find( '=' );
+				if( eq == string::npos )
+					continue;
+
+				field.key = item.substr( 0, eq );
+				field.value = item.substr( eq + 1 );
+				field.pref = PCI_OVERRIDE_PREF;
+				at = field.key.find( '@' );
+				if( at != string::npos )
+				{
+					field.pref = atoi( field.key.c_str( ) + at + 1 );
+					field.key.erase( at );
+				}
+
+				for( i = 0; keys[ i ] != NULL; i++ )
+					if( field.key == keys[ i ] )
+						break;
+				if( keys[ i ] == NULL )
+				{
+					logger.log( "Unknown field " + field.key + " in " +
+						    filename, LOG_WARNING );
+					continue;
+				}
+				entry.push_back( field );
+			}
+
+			( anySub ? mPciOverridesAnySub : mPciOverrides )
+				[ pciOverrideKey( vendor, device, subVendor,
+						  subDevice ) ] = entry;
+		}
+		return 0;
+	}
+
 	void SysFSTreeCollector::setCustomVPDFields(Component* fillMe,
 			int vendorId, int deviceId,
 			int subVendorId, int subDeviceId)
 	{
-		int sysPciId = (vendorId << 16) | deviceId;
-		int subSysPciId = (subVendorId << 16) | subDeviceId;
-
-		switch(sysPciId) {
-			case 0x101406A7:
-			case 0x101406A8:
-				fillMe->mFeatureCode.setValue("ECSE", 95, __FILE__, __LINE__);
-				fillMe->mFRU.setValue("03PN188", 100, __FILE__, __LINE__);
-				fillMe->addDeviceSpecific( "CC", "Customer Card ID Number", "2E1F", 95);
-				break;
-			case 0x15b31021: // Nvidia ConnectX-7 PF
-				switch (subSysPciId) {
-					case 0x15b30030:  // CX7 Fractal PF
-						fillMe->mPartNumber.setValue("03JP126", 95, __FILE__, __LINE__);
-						fillMe->mEngChangeLevel.setValue("P45996", 95, __FILE__, __LINE__);
-						fillMe->mFRU.setValue("03JP128", 95, __FILE__, __LINE__);
-						fillMe->mFeatureCode.setValue("EAPC / EAPD", 95, __FILE__, __LINE__);
-						fillMe->addDeviceSpecific("CE", "CCIN Extension", "EC26", 95);
-                        fillMe->mDescription.setValue(fillMe->mDescription.getValue() +
-                            " PCIe4 4-Port 25Gb/10Gb RoCE SFP28 Adapter", 95, __FILE__, __LINE__);
-						break;
+		unordered_map<uint64_t, vector<PciOverrideField> >::const_iterator i;
+		vector<PciOverrideField>::const_iterator f;
 
-					case 0x15b30022:  // CX7 Onion Creek PF
-						fillMe->mPartNumber.setValue("03JP134", 95, __FILE__, __LINE__);
-						fillMe->mEngChangeLevel.setValue("P45997", 95, __FILE__, __LINE__);
-						fillMe->mFRU.setValue("03JP136", 95, __FILE__, __LINE__);
-						fillMe->mFeatureCode.setValue("EAPE / EAPF", 95, __FILE__, __LINE__);
-						fillMe->addDeviceSpecific("CE", "CCIN Extension", "EC2E", 95);
-                        fillMe->mDescription.setValue(fillMe->mDescription.getValue() +
-                            " PCIe5 2-Port 100GbE RoCE QSFP56 Adapter", 95, __FILE__, __LINE__);
-						break;
+		if (!mPciOverridesLoaded) {
+			loadPciOverrides(PCI_OVERRIDES_FILE);
+			mPciOverridesLoaded = true;
+		}
 
-					default:
-						break;
-				}
-				break;
+		/* This exact adapter, or the device with any subsystem */
+		i = mPciOverrides.find(pciOverrideKey(vendorId, deviceId,
+						      subVendorId, subDeviceId));
+		if (i == mPciOverrides.end()) {
+			i = mPciOverridesAnySub.find(pciOverrideKey(vendorId,
+							deviceId, 0, 0));
+			if (i == mPciOverridesAnySub.end())
+				return;
+		}
 
-			case 0x15b3101e:  // NVIDIA ConnectX-7 SR-IOV (Vendor: 15b3, Device: 101e)
-				switch (subSysPciId) {
-					case 0x15b30030:  // CX7 Fractal SR-IOV
-						fillMe->mPartNumber.setValue("03JP126", 95, __FILE__, __LINE__);
-						fillMe->mEngChangeLevel.setValue("P45996", 95, __FILE__, __LINE__);
-						fillMe->mFRU.setValue("03JP128", 95, __FILE__, __LINE__);
-						fillMe->mFeatureCode.setValue("EAPC / EAPD", 95, __FILE__, __LINE__);
-						fillMe->addDeviceSpecific("CE", "CCIN Extension", "EC26", 95);
-                        fillMe->mDescription.setValue(fillMe->mDescription.getValue() +
-                            " PCIe4 4-Port 25Gb/10Gb RoCE SFP28 Adapter", 95, __FILE__, __LINE__);
-						break;
+		for (f = i->second.begin(); f != i->second.end(); ++f) {
+			if (f->key == "PN")
+				fillMe->mPartNumber.setValue(f->value, f->pref, __FILE__, __LINE__);
+			else if (f->key == "EC")
+				fillMe->mEngChangeLevel.setValue(f->value, f->pref, __FILE__, __LINE__);
+			else if (f->key == "FN")
+				fillMe->mFRU.setValue(f->value, f->pref, __FILE__, __LINE__);
+			else if (f->key == "FC")
+				fillMe->mFeatureCode.setValue(f->value, f->pref, __FILE__, __LINE__);
+			else if (f->key == "CC")
+				fillMe->addDeviceSpecific("CC", "Customer Card ID Number",
+							  f->value, f->pref);
+			else if (f->key == "CE")
+				fillMe->addDeviceSpecific("CE", "CCIN Extension",
+							  f->value, f->pref);
+			else if (f->key == "DS")
+				fillMe->mDescription.setValue(fillMe->mDescription.getValue() +
+					" " + f->value, f->pref, __FILE__, __LINE__);
+		}
+	}
 
-					case 0x15b30022:  // CX7 Onion Creek SR-IOV
-						fillMe->mPartNumber.setValue("03JP134", 95, __FILE__, __LINE__);
-						fillMe->mEngChangeLevel.setValue("P45997", 95, __FILE__, __LINE__);
-						fillMe->mFRU.setValue("03JP136", 95, __FILE__, __LINE__);
-						fillMe->mFeatureCode.setValue("EAPE / EAPF", 95, __FILE__, __LINE__);
-						fillMe->addDeviceSpecific("CE", "CCIN Extension", "EC2E", 95);
-                        fillMe->mDescription.setValue(fillMe->mDescription.getValue() +
-                            " PCIe5 2-Port 100GbE RoCE QSFP56 Adapter", 95, __FILE__, __LINE__);
-						break;
+	/**
+	 * Find the PCIe Device Serial Number extended capability of the
+	 * function at sysDir.  Needs root, other users only see the first
+	 * 64 bytes of config space.
+	 * @return true if dsn holds the adapter's serial number
+	 */
+	static bool readPciDsn( const string& sysDir, unsigned long long& dsn )
+	{
+		string path = sysDir + "/config";
+		uint32_t hdr, words[ 2 ];
+		int fd, pos = 0x100, count = 0;
+		bool found = false;
 
-					default:
-						break;
+		fd = open( path.c_str( ), O_RDONLY );
+		if( fd < 0 )
+			return false;
+
+		// Extended capabilities are a list from 0x100, little endian.
+		while( pos >= 0x100 && count++ < ( 0x1000 - 0x100 ) / 4 )
+		{
+			if( pread( fd, &hdr, sizeof( hdr ), pos ) != sizeof( hdr ) )
+				break;
+			hdr = le32toh( hdr );
+			if( hdr == 0 || hdr == 0xffffffff )
+				break;
+
+			if( ( hdr & 0xffff ) == PCI_EXT_CAP_ID_DSN )
+			{
+				if( pread( fd, words, sizeof( words ), pos + 4 ) ==
+				    sizeof( words ) )
+				{
+					dsn = (unsigned long long)le32toh( words[ 1 ] )
+						<< 32 | le32toh( words[ 0 ] );
+					found = true;
 				}
 				break;
 			}
+			pos = ( hdr >> 20 ) & 0xffc;
+		}
+
+		close( fd );
+		return found;
 	}
 
+	/**
+	 * @return the /sys dir of the physical function an SR-IOV virtual
+	 *   function at sysDir belongs to, or "" for any other device
+	 */
+	static string getPhysFn( const string& sysDir )
+	{
+		char buf[ PATH_MAX ];
+		string link = sysDir + "/physfn";
+
+		if( realpath( link.c_str( ), buf ) == NULL )
+			return "";
+		return string( buf );
+	}
 
 	/* Parse VPD file */
-	void SysFSTreeCollector::fillPciDevVpd( Component* fillMe )
+	void SysFSTreeCollector::fillPciDevVpd( Component* fillMe,
+						const string& node,
+						const PciConfigIds* ids )
 	{
-		int size;
-		string path, vpdDataStr;
+		int size, ret;
+		string path, vpdDataStr, identity, slot;
+		map<string, string>::iterator cached;
+		unsigned long long dsn;
+		PciConfigIds nodeIds;
+		ostringstream os;
 
-		path = fillMe->sysFsNode.getValue() + "/vpd";
-		if (HelperFunctions::file_exists(path) != true)
+		/* The VFs of one PF all come here with the PF's node */
+		cached = mPciVpdKeys.find(node);
+		if (cached != mPciVpdKeys.end()) {
+			cached = mPciVpd.find(cached->second);
+			if (cached != mPciVpd.end() && cached->second.length() > 0)
+				parsePciVPDBuffer(fillMe, cached->second.data(),
+						  cached->second.length());
 			return;
+		}
+
+		path = node + "/vpd";
+		if (HelperFunctions::file_exists(path) != true) {
+			mPciVpdKeys[node] = "";
+			return;
+		}
+
+		if (ids == NULL) {
+			readPciConfigIds(node, nodeIds);
+			ids = &nodeIds;
+		}
+
+		/*
+		 * Reading vpd goes out to the adapter, and every function of a
+		 * multi-function card returns the same VPD.  Key it by slot
+		 * (the BDF without its function), IDs and PCIe serial number
+		 * so it is read once per run.  Each run reads it again, since
+		 * a firmware update can rewrite it without changing any of
+		 * those; what is stored is only used when reparsing.
+		 */
+		slot = node.substr(node.rfind('/') + 1);
+		slot = slot.substr(0, slot.rfind('.'));
+		os << "pci " << slot << " " << hex << setfill('0') <<
+			setw(4) << ids->vendor << ":" << setw(4) << ids->device <<
+			":" << setw(4) << ids->subVendor << ":" << setw(4) <<
+			ids->subDevice << ":" << setw(2) << (ids->revision & 0xff);
+		if (readPciDsn(node, dsn))
+			os << " dsn " << setw(16) << dsn;
+		identity = os.str();
+		mPciVpdKeys[node] = identity;
+
+		cached = mPciVpd.find(identity);
+		if (cached != mPciVpd.end()) {
+			vpdDataStr = cached->second;
+		} else {
+			if (!storedRawData(identity, RAW_PCI_VPD, vpdDataStr, ret)) {
+				/* Reparsing: nothing stored, leave the adapter be */
+				if (mInquiryCache != NULL && mInquiryCache->reparse())
+					return;
+				vpdDataStr = readPciVpd(path);
+			}
+			mPciVpd[identity] = vpdDataStr;
+		}
+		storeRawData(identity, RAW_PCI_VPD, vpdDataStr, 0);
 
-		vpdDataStr = getBinaryData(path);
 		if ((size = vpdDataStr.length()) == 0)
 			return;
 
@@ -1810,38 +2236,84 @@ ERROR:
 		parsePciVPDBuffer( fillMe, vpdDataStr.data(), size );
 	}
 
-	void SysFSTreeCollector::fillPCIDev( Component* fillMe,
-					     const string& sysDir )
+	void SysFSTreeCollector::readPciConfigIds( const string& sysDir,
+						   PciConfigIds& ids )
 	{
-		string val;
-		int manID = UNKNOWN_ID, devID = UNKNOWN_ID;
-		int subMan = UNKNOWN_ID, subID = UNKNOWN_ID;
-		setKernelName( fillMe, sysDir );
+		unsigned char cfg[ PCI_CONFIG_HEADER_LEN ];
+		string path = sysDir + "/config", val;
+		ssize_t len = -1;
+		int fd;
 
-		// Get the ID numbers from sysfs.
-		val = getAttrValue( sysDir, "vendor" );
-		if( val != "" )
+		ids.vendor = ids.device = UNKNOWN_ID;
+		ids.subVendor = ids.subDevice = UNKNOWN_ID;
+		ids.revision = ids.classCode = ids.headerType = -1;
+
+		fd = open( path.c_str( ), O_RDONLY );
+		if( fd >= 0 )
 		{
-			manID = strtol( val.c_str( ), NULL, 16 );
+			len = pread( fd, cfg, sizeof( cfg ), 0 );
+			close( fd );
 		}
 
-		val = getAttrValue( sysDir, "device" );
-		if( val != "" )
+		// Config space is little endian.
+		if( len == PCI_CONFIG_HEADER_LEN )
 		{
-			devID = strtol( val.c_str( ), NULL, 16 );
+			ids.vendor = cfg[ 0x00 ] | cfg[ 0x01 ] << 8;
+			ids.device = cfg[ 0x02 ] | cfg[ 0x03 ] << 8;
+			ids.revision = cfg[ 0x08 ];
+			ids.classCode = cfg[ 0x09 ] | cfg[ 0x0a ] << 8 |
+				cfg[ 0x0b ] << 16;
+			ids.headerType = cfg[ 0x0e ] & 0x7f;
+
+			// Only a type 0 header has subsystem IDs at 0x2c.
+			if( ids.headerType == 0 )
+			{
+				ids.subVendor = cfg[ 0x2c ] | cfg[ 0x2d ] << 8;
+				ids.subDevice = cfg[ 0x2e ] | cfg[ 0x2f ] << 8;
+			}
 		}
 
-		val = getAttrValue( sysDir, "subsystem_vendor" );
-		if( val != "" )
+		/*
+		 * SR-IOV VFs read 0xffff as their vendor and device, and bridges
+		 * keep subsystem IDs in a capability: the kernel knows them.
+		 */
+		if( ids.vendor == UNKNOWN_ID )
 		{
-			subMan = strtol( val.c_str( ), NULL, 16 );
+			val = getAttrValue( sysDir, "vendor" );
+			if( val != "" )
+				ids.vendor = strtol( val.c_str( ), NULL, 16 );
+
+			val = getAttrValue( sysDir, "device" );
+			if( val != "" )
+				ids.device = strtol( val.c_str( ), NULL, 16 );
 		}
 
-		val = getAttrValue( sysDir, "subsystem_device" );
-		if( val != "" )
+		if( ids.subVendor == UNKNOWN_ID )
 		{
-			subID = strtol( val.c_str( ), NULL, 16 );
+			val = getAttrValue( sysDir, "subsystem_vendor" );
+			if( val != "" )
+				ids.subVendor = strtol( val.c_str( ), NULL, 16 );
+
+			val = getAttrValue( sysDir, "subsystem_device" );
+			if( val != "" )
+				ids.subDevice = strtol( val.c_str( ), NULL, 16 );
 		}
+	}
+
+	void SysFSTreeCollector::fillPCIDev( Component* fillMe,
+					     const string& sysDir )
+	{
+		string val, physfn;
+		PciConfigIds ids;
+		int manID, devID, subMan, subID;
+		setKernelName( fillMe, sysDir );
+
+		// Get the ID numbers from config space.
+		readPciConfigIds( sysDir, ids );
+		manID = ids.vendor;
+		devID = ids.device;
+		subMan = ids.subVendor;
+		subID = ids.subDevice;
 
 		ostringstream os;
 
@@ -1902,8 +2374,15 @@ ERROR:
 
 		fillPCIDS( fillMe );
 
-		/* Fill PCI device VPD info */
-		fillPciDevVpd(fillMe);
+		/*
+		 * Fill PCI device VPD info.  An SR-IOV VF has no VPD of its
+		 * own, it is the adapter's, read once through the PF.
+		 */
+		physfn = getPhysFn( sysDir );
+		if( physfn.empty( ) )
+			fillPciDevVpd( fillMe, fillMe->sysFsNode.getValue( ), &ids );
+		else
+			fillPciDevVpd( fillMe, physfn, NULL );
 
 		/* Set custom VPD fields for specific devices */
 		setCustomVPDFields(fillMe, manID, devID, subMan, subID);
@@ -1914,30 +2393,14 @@ ERROR:
 		/* Fill Spyre information */
 		fillSpyreVpd(fillMe);
 
-		// Read the pci config file for Device Specific (YC)
-		os.str( "" );
-		os << fillMe->sysFsNode.dataValue << "/config";
-		int fd, size;
-		char data = 0;
-		fd = open( os.str( ).c_str( ), O_RDONLY );
-		if( fd < 0 )
+		// Device Specific (YC) is the revision ID
+		if( ids.revision < 0 )
 		{
 			return;
 		}
 
-		if( pread( fd, &data, 1, 8 ) < 1 )
-		{
-			close( fd );
-			return;
-		}
-
-		close( fd );
 		os.str( "" );
-
-		size = (int)data;
-		if( size < 0 )
-			size *= -1;
-		os << dec << (int)size;
+		os << dec << ids.revision;
 		fillMe->addDeviceSpecific( "YC", "Device Specific", os.str( ), 100 );
 	}
 
@@ -2066,6 +2529,29 @@ ERROR:
 		int device_fd;
 
 		dev_syspath = fillMe->sysFsNode.getValue();
+
+		/*
+		 * The kernel already read Identify Controller: take model,
+		 * serial number and firmware level from sysfs.  The f1h log
+		 * page, if present, overrides them with a higher preference.
+		 */
+		str = trimAttr( getAttrValue( dev_syspath, "model" ) );
+		if (!str.empty())
+			fillMe->mModel.setValue( str, 50, __FILE__, __LINE__ );
+
+		str = trimAttr( getAttrValue( dev_syspath, "serial" ) );
+		if (!str.empty())
+			fillMe->mSerialNumber.setValue( str, 50, __FILE__, __LINE__ );
+
+		str = trimAttr( getAttrValue( dev_syspath, "firmware_rev" ) );
+		if (!str.empty())
+			fillMe->mFirmwareVersion.setValue( str, 50, __FILE__,
+							   __LINE__ );
+
+		/* Only go to the device if a template can decode its log page */
+		if (!haveNvmeTemplates(dev_syspath))
+			return;
+
 		fsw.fs_getDirContents(dev_syspath, 'd', listing);
 		if (listing.size() <= 0) {
 			Logger().log("fillNvmeClass: NVMe dev not found.",
@@ -2112,6 +2598,13 @@ ERROR:
 		fillMe->devMinor = atoi(str.substr(beg, end).c_str());
 		fillMe->devAccessMode = S_IFBLK;
 
+		/* Reparsing: only what was stored, never open the device */
+		device_fd = -1;
+		if (mInquiryCache != NULL && mInquiryCache->reparse()) {
+			collectVpd(fillMe, device_fd, false);
+			return;
+		}
+
 		device_fd = device_open(fillMe);
 		if (device_fd < 0)
 			return;
@@ -2138,6 +2631,20 @@ ERROR:
 		struct ifreq ifr;
 		int fd;
 
+		/*
+		 * A VF runs its adapter's firmware.  Once the PF has been
+		 * asked, skip the socket and ioctl for each of its VFs.
+		 */
+		map<string, string>::const_iterator fw;
+		fw = mNetFirmware.find( getPhysFn( fillMe->sysFsNode.getValue( ) ) );
+		if( fw != mNetFirmware.end( ) )
+		{
+			if( fw->second != "" && fw->second != "N/A" )
+				fillMe->mFirmwareVersion.setValue( fw->second, 80,
+								   __FILE__, __LINE__ );
+			return;
+		}
+
 		fd = socket( AF_INET, SOCK_DGRAM, 0 );
 		if( fd < 0 )
 		{
@@ -2179,6 +2686,7 @@ ERROR:
 		close( fd );
 
 		val = info.fw_version;
+		mNetFirmware[ fillMe->sysFsNode.getValue( ) ] = val;
 		if( val != "" && val != "N/A" )
 			fillMe->mFirmwareVersion.setValue( val, 80, __FILE__, __LINE__ );
 	}
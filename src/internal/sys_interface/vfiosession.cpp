@@ -0,0 +1,256 @@
+/***************************************************************************
+ *   Copyright (C) 2006, IBM                                               *
+ *                                                                         *
+ *   Maintained by:                                                        *
+ *   Eric Munson and Brad Peters                                           *
+ *   munsone@us.ibm.com, bpeters@us.ibm.com                                *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <vfiosession.hpp>
+
+#include <libvpd-2/logger.hpp>
+
+#include <linux/vfio.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+namespace lsvpd
+{
+	VfioSession::VfioSession( ) :
+		mContainer( -1 ), mBroken( false ), mIommuType( -1 ),
+		mIommuSet( false )
+	{
+	}
+
+	VfioSession::~VfioSession( )
+	{
+		map<string, int>::iterator i;
+
+		/* Groups first, a container goes when its last one leaves */
+		for( i = mGroups.begin( ); i != mGroups.end( ); ++i )
+			close( i->second );
+
+		for( i = mPrivate.begin( ); i != mPrivate.end( ); ++i )
+			close( i->second );
+
+		if( mContainer >= 0 )
+			close( mContainer );
+	}
+
+	/**
+	 * Open /dev/vfio/vfio and pick the IOMMU type, once per session.
+	 * @return 0, or -errno if there is no usable container
+	 */
+	int VfioSession::openContainer( )
+	{
+		Logger l;
+		int err;
+
+		if( mContainer >= 0 )
+			return 0;
+		if( mBroken )
+			return -ENODEV;
+
+		mContainer = open( "/dev/vfio/vfio", O_RDWR );
+		if( mContainer < 0 )
+		{
+			err = errno;
+			l.log( string( "Failed to open VFIO container /dev/vfio/vfio, errno: " ) +
+			       to_string( err ) + " (" + strerror( err ) + ")", LOG_ERR );
+			mBroken = true;
+			return -err;
+		}
+
+		if( ioctl( mContainer, VFIO_CHECK_EXTENSION, VFIO_TYPE1_IOMMU ) == 1 )
+			mIommuType = VFIO_TYPE1_IOMMU;
+		else if( ioctl( mContainer, VFIO_CHECK_EXTENSION,
+				VFIO_SPAPR_TCE_IOMMU ) == 1 )
+			mIommuType = VFIO_SPAPR_TCE_IOMMU;
+		else
+		{
+			l.log( "No supported VFIO IOMMU type found", LOG_ERR );
+			close( mContainer );
+			mContainer = -1;
+			mBroken = true;
+			return -ENODEV;
+		}
+
+		l.log( "Opened VFIO container, IOMMU type " + to_string( mIommuType ),
+		       LOG_DEBUG );
+		return 0;
+	}
+
+	/**
+	 * Add groupFd to container.  The IOMMU type can only be set once
+	 * the container holds a group, so that happens with the first one,
+	 * recorded in iommuSet.
+	 * @return 0, or -errno
+	 */
+	int VfioSession::setContainer( const string& group, int groupFd,
+				       int container, bool& iommuSet )
+	{
+		Logger l;
+		int err;
+
+		if( ioctl( groupFd, VFIO_GROUP_SET_CONTAINER, &container ) < 0 )
+		{
+			err = errno;
+			l.log( "Failed to add VFIO group " + group + " to container, errno: " +
+			       to_string( err ) + " (" + strerror( err ) + ")", LOG_ERR );
+			return -err;
+		}
+
+		if( !iommuSet )
+		{
+			if( ioctl( container, VFIO_SET_IOMMU, mIommuType ) < 0 )
+			{
+				err = errno;
+				l.log( "Failed to set IOMMU type " + to_string( mIommuType ) +
+				       ", errno: " + to_string( err ) + " (" + strerror( err ) + ")",
+				       LOG_ERR );
+				ioctl( groupFd, VFIO_GROUP_UNSET_CONTAINER );
+				return -err;
+			}
+			iommuSet = true;
+		}
+
+		return 0;
+	}
+
+	/**
+	 * Check groupFd is viable and add it to the shared container, or
+	 * to a private one if the shared container already holds a group
+	 * and refuses another.
+	 * @return 0, or -errno
+	 */
+	int VfioSession::attachGroup( const string& group, int groupFd )
+	{
+		struct vfio_group_status status;
+		bool shared = mIommuSet, privateSet = false;
+		int container, rc, err;
+		Logger l;
+
+		memset( &status, 0, sizeof( status ) );
+		status.argsz = sizeof( status );
+		if( ioctl( groupFd, VFIO_GROUP_GET_STATUS, &status ) < 0 ||
+		    !( status.flags & VFIO_GROUP_FLAGS_VIABLE ) )
+		{
+			err = errno ? errno : EINVAL;
+			l.log( "VFIO group " + group + " is not viable, errno: " +
+			       to_string( err ) + " (" + strerror( err ) + ")", LOG_ERR );
+			return -err;
+		}
+
+		rc = setContainer( group, groupFd, mContainer, mIommuSet );
+		if( rc == 0 )
+		{
+			l.log( "Added VFIO group " + group + " to container", LOG_DEBUG );
+			return 0;
+		}
+
+		/* The first group failing has nothing to do with sharing */
+		if( !shared )
+			return rc;
+
+		container = open( "/dev/vfio/vfio", O_RDWR );
+		if( container < 0 )
+			return rc;
+
+		if( setContainer( group, groupFd, container, privateSet ) < 0 )
+		{
+			close( container );
+			return rc;
+		}
+
+		mPrivate[ group ] = container;
+		l.log( "Added VFIO group " + group + " to a container of its own",
+		       LOG_DEBUG );
+		return 0;
+	}
+
+	int VfioSession::getDeviceFd( const string& sysDir, bool& groupOpened )
+	{
+		char target[ PATH_MAX ];
+		string link = sysDir + "/iommu_group", group, path;
+		map<string, int>::iterator i;
+		int groupFd, deviceFd, rc, err;
+		ssize_t len;
+		Logger l;
+
+		groupOpened = true;
+
+		rc = openContainer( );
+		if( rc < 0 )
+			return rc;
+
+		len = readlink( link.c_str( ), target, sizeof( target ) - 1 );
+		if( len < 0 )
+		{
+			err = errno;
+			l.log( "Failed to read IOMMU group symlink " + link + ", errno: " +
+			       to_string( err ) + " (" + strerror( err ) + ")", LOG_ERR );
+			return -err;
+		}
+		target[ len ] = '\0';
+		group = target;
+		group = group.substr( group.rfind( '/' ) + 1 );
+
+		i = mGroups.find( group );
+		if( i != mGroups.end( ) )
+			groupFd = i->second;
+		else
+		{
+			path = "/dev/vfio/" + group;
+			groupFd = open( path.c_str( ), O_RDWR );
+			if( groupFd < 0 )
+			{
+				err = errno;
+				l.log( "Failed to open VFIO group " + path + " for " + sysDir,
+				       LOG_ERR );
+				groupOpened = false;
+				return -err;
+			}
+
+			rc = attachGroup( group, groupFd );
+			if( rc < 0 )
+			{
+				close( groupFd );
+				return rc;
+			}
+			mGroups[ group ] = groupFd;
+		}
+
+		deviceFd = ioctl( groupFd, VFIO_GROUP_GET_DEVICE_FD,
+				  sysDir.substr( sysDir.rfind( '/' ) + 1 ).c_str( ) );
+		if( deviceFd < 0 )
+		{
+			err = errno;
+			l.log( "Failed to get VFIO device FD for " + sysDir + ", errno: " +
+			       to_string( err ) + " (" + strerror( err ) + ")", LOG_ERR );
+			return -err;
+		}
+
+		return deviceFd;
+	}
+}
@@ -55,17 +55,19 @@
 #include <gatherer.hpp>
 #include <devicetreecollector.hpp>
 #include <platformcollector.hpp>
+#include <spyrevpd.hpp>
 
 using namespace lsvpd;
 using namespace std;
 
-int initializeDB( bool limitSCSI );
+int initializeDB( bool limitSCSI, InquiryCacheMode cacheMode );
 int storeComponents( System* root, VpdDbEnv& db );
 int storeComponents( Component* root, VpdDbEnv& db );
 void printUsage( );
 void printVersion( );
 int ensureEnv( const string& env, const string& file );
 void archiveDB( const string& fullPath );
+int writeSpyreIndex( );
 int __lsvpdInit( VpdDbEnv::UpdateLock *lock );
 void __lsvpdFini(void);
 void lsvpdSighandler(int sig);
@@ -79,14 +81,27 @@ const string SPYRE_DB_FILENAME("spyre.db");
 VpdDbEnv *spyreDb = nullptr;
 VpdDbEnv::UpdateLock *spyreDbLock = nullptr;
 
+/*
+ * IDs of the Spyre cards stored in vpd.db, one per line, written once
+ * the db is closed so the next run can pick them out without scanning
+ * it.  The header line after the magic identifies the db file the
+ * index was written for:
+ *
+ *   lsvpd-spyre-index 2
+ *   S <inode> <mtime>.<nsec> <size>
+ *   <id>
+ *   ...
+ */
+const string SPYRE_INDEX_FILENAME("spyre.index");
+#define SPYRE_INDEX_MAGIC "lsvpd-spyre-index 2"
+vector<string> spyreIds;	/* Spyre cards stored this run */
+
 bool isRoot(void);
 VpdDbEnv *db;
 VpdDbEnv::UpdateLock *dblock;
 
 string env = DB_DIR, file = DB_FILENAME;
 
-extern std::map<std::string, bool> g_deviceAccessible;
-
 /**
  * @brief Cleans up resources allocated by __spyreDbInit()
  */
@@ -169,10 +184,11 @@ void logProcessHierarchy() {
 
 int main( int argc, char** argv )
 {
-	char opts [] = "vahsp:";
+	char opts [] = "vahsnrp:";
 	bool done = false;
 	int index = 0, rc = 1;
 	bool limitSCSISize = false;
+	InquiryCacheMode cacheMode = CACHE_REUSE;
 	VpdDbEnv::UpdateLock *lock;
 	string platform = PlatformCollector::get_platform_name();
 
@@ -195,6 +211,8 @@ int main( int argc, char** argv )
 		{ "archive", 0, 0, 'a' },
 		{ "version", 0, 0, 'v' },
 		{ "scsi", 0, 0, 's' },
+		{ "no-cache", 0, 0, 'n' },
+		{ "reparse", 0, 0, 'r' },
 		{ 0, 0, 0, 0 }
 	};
 
@@ -213,6 +231,14 @@ int main( int argc, char** argv )
 			limitSCSISize = true;
 			break;
 
+		case 'n':
+			cacheMode = CACHE_IGNORE;
+			break;
+
+		case 'r':
+			cacheMode = CACHE_REPARSE;
+			break;
+
 		case 'v':
 			printVersion( );
 			return 0;
@@ -244,9 +270,12 @@ int main( int argc, char** argv )
 
 	l.log( "vpdupdate: Constructing full devices database", LOG_NOTICE );
 	logProcessHierarchy();
-	rc = initializeDB( limitSCSISize );
+	rc = initializeDB( limitSCSISize, cacheMode );
 
 	__lsvpdFini();
+	if (rc == 0 && writeSpyreIndex() != 0)
+		l.log( "Unable to write the Spyre index, the next update will "
+		       "scan the whole database.", LOG_WARNING );
 	cleanupSpyreFiles(env);
 	return rc;
 }
@@ -352,6 +381,8 @@ void archiveDB( const string& fullPath )
 			return;
 		}
 		unlink( fullPath.c_str( ) );
+		/* The index described the db that was just moved away */
+		unlink( ( env + "/" + SPYRE_INDEX_FILENAME ).c_str( ) );
 
 		if( stat( os.str( ).c_str( ), &st ) == 0 )
 		{
@@ -436,7 +467,116 @@ bool isSpyreDevice(Component* comp)
 }
 
 /**
- * @brief Extract spyre device data from existing vpd.db
+ * @brief Identify one version of the db file at path.
+ * @return inode, modification time and size, or "none" if it's missing
+ */
+string dbStamp(const string& path)
+{
+	struct stat info;
+	ostringstream os;
+
+	if (stat(path.c_str(), &info) != 0)
+		return "none";
+
+	os << (unsigned long long)info.st_ino << " " <<
+		(long long)info.st_mtime << "." << (long)info.st_mtim.tv_nsec <<
+		" " << (long long)info.st_size;
+	return os.str();
+}
+
+/**
+ * @brief Read the Spyre index written with the existing vpd.db.
+ * @return false if there is no usable index
+ */
+bool readSpyreIndex(vector<string>& ids)
+{
+	string path = env + "/" + SPYRE_INDEX_FILENAME, line;
+	ifstream in(path.c_str());
+
+	ids.clear();
+	if (!in || !getline(in, line) || line != SPYRE_INDEX_MAGIC)
+		return false;
+
+	/* Written for another db: restored, or by an older vpdupdate */
+	if (!getline(in, line) || line != "S " + dbStamp(env + "/" + file))
+		return false;
+
+	while (getline(in, line))
+		if (!line.empty())
+			ids.push_back(line);
+
+	return true;
+}
+
+/**
+ * @brief Add the ID of every Spyre card under comp to ids.  A card is
+ *	known by the VPD source keyword fillSpyreVpd gives it, whether or
+ *	not its VPD could be had.
+ */
+void findSpyreCards(Component* comp, vector<string>& ids)
+{
+	vector<DataItem*>::const_iterator d;
+	vector<Component*>::const_iterator i;
+
+	const vector<DataItem*>& specific = comp->getDeviceSpecific();
+	for (d = specific.begin(); d != specific.end(); ++d) {
+		if ((*d)->getAC() == SPYRE_VPD_SOURCE) {
+			ids.push_back(comp->getID());
+			break;
+		}
+	}
+
+	const vector<Component*>& children = comp->getLeaves();
+	for (i = children.begin(); i != children.end(); ++i)
+		findSpyreCards(*i, ids);
+}
+
+/**
+ * @brief Record the Spyre cards stored in vpd.db next to it.  Only
+ *	called once the db is closed, so the stamp is that of the file
+ *	the next run will find.
+ * @return 0 on success, -errno on failure
+ */
+int writeSpyreIndex()
+{
+	string path = env + "/" + SPYRE_INDEX_FILENAME;
+	string tmpPath = path + ".tmp";
+	string stamp = dbStamp(env + "/" + file);
+	vector<string>::const_iterator i;
+	ofstream out;
+	int err;
+
+	if (stamp == "none")
+		return -ENOENT;
+
+	out.open(tmpPath.c_str(), ios::out | ios::trunc);
+	if (!out)
+		return -errno;
+
+	out << SPYRE_INDEX_MAGIC << endl;
+	out << "S " << stamp << endl;
+	for (i = spyreIds.begin(); i != spyreIds.end(); ++i)
+		out << *i << endl;
+
+	out.close();
+	if (!out) {
+		unlink(tmpPath.c_str());
+		return -EIO;
+	}
+
+	if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+		err = errno;
+		unlink(tmpPath.c_str());
+		return -err;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Extract spyre device data from existing vpd.db.  The Spyre
+ *	index written with it names the rows to copy; a db written before
+ *	there was an index is scanned in full instead.
  */
 void extractSpyreData()
 {
@@ -449,9 +589,23 @@ void extractSpyreData()
                return;
        }
 
+       vector<string> spyreKeys;
+       bool indexed = readSpyreIndex(spyreKeys);
+
        VpdDbEnv::UpdateLock* mainLock = new VpdDbEnv::UpdateLock(env, file, true);
        VpdDbEnv mainDb(*mainLock);
 
+       if (indexed) {
+               for (const string& key : spyreKeys) {
+                       Component* comp = mainDb.fetch(key);
+                       if (comp) {
+                               spyreDb->store(comp);
+                               delete comp;
+                       }
+               }
+               return;
+       }
+
        vector<string> allKeys = mainDb.getKeys();
        for (const string& key : allKeys) {
                if (key.empty() || key == "/sys/bus") {
@@ -495,7 +649,7 @@ int __spyreDbInit()
  * be done once at boot time or any time that a user wishes to start with
  * a new db. And, handles spyre.db population with spyre devices.
  */
-int initializeDB( bool limitSCSI )
+int initializeDB( bool limitSCSI, InquiryCacheMode cacheMode )
 {
 	VpdDbEnv::UpdateLock *lock;
 	System * root;
@@ -526,7 +680,7 @@ int initializeDB( bool limitSCSI )
 	 * any db it finds */
 	dblock = lock;
 
-	Gatherer info( limitSCSI );
+	Gatherer info( limitSCSI, cacheMode );
 	ret = __lsvpdInit(lock);
 
 	if ( ret != 0 ) {
@@ -550,6 +704,14 @@ int initializeDB( bool limitSCSI )
 		Logger l;
 		l.log( "Saving components to database failed.", LOG_ERR );
 	}
+	else
+	{
+		/* The index is written by main once the db is closed */
+		vector<Component*>::const_iterator c;
+		const vector<Component*>& children = root->getLeaves( );
+		for( c = children.begin( ); c != children.end( ); ++c )
+			findSpyreCards( *c, spyreIds );
+	}
 
 	delete root;
 	return ret;
@@ -732,6 +894,9 @@ void printUsage( )
 	cout << " --path=PATH, -pPATH Sets the path to the vpd db to PATH" << endl;
 	cout << " --archive,   -a     Archives the current VPD database" << endl;
 	cout << " --scsi,      -s     Limit size of SCSI device inquiry to 36 bytes" << endl;
+	cout << " --no-cache,  -n     Ignore cached SCSI inquiry data and query every device" << endl;
+	cout << " --reparse,   -r     Rebuild the database from stored device data, applying" << endl;
+	cout << "                     changed templates without querying devices again" << endl;
 }
 
 void printVersion( )